@@ -0,0 +1,33 @@
+;; list and string churn: building, mapping, sorting and searching lists
+
+(define (iota n)
+  (define (loop i acc)
+    (if (= i 0) acc (loop (- i 1) (cons i acc))))
+  (loop n '()))
+
+(define (scramble l)
+  (map (lambda (x) (mod (* x 7919) 1009)) l))
+
+(define words '("sparrow" "lisp" "scheme" "eval" "apply" "closure" "frame" "symbol"))
+
+(define (tag l)
+  (map (lambda (x) (cons (mod x 8) (list-ref words (mod x 8)))) l))
+
+(define (list-ref l k)
+  (if (= k 0) (car l) (list-ref (cdr l) (- k 1))))
+
+(define (churn n)
+  (let ((l (scramble (iota n))))
+    (let ((sorted (sort l)))
+      (length (filter (lambda (p) (equal? (cdr p) "closure"))
+                      (tag (append sorted (reverse-list l))))))))
+
+(define (reverse-list l)
+  (foldl (lambda (acc x) (cons x acc)) '() l))
+
+(define (repeat n)
+  (if (= n 0)
+    #t
+    (begin (churn 400) (repeat (- n 1)))))
+
+(repeat 4)
@@ -0,0 +1,26 @@
+;; symbolic differentiation: symbols, quoted data and consing
+
+(define (deriv a)
+  (cond ((not (pair? a))
+         (if (equal? a 'x) 1 0))
+        ((equal? (car a) '+)
+         (cons '+ (map deriv (cdr a))))
+        ((equal? (car a) '-)
+         (cons '- (map deriv (cdr a))))
+        ((equal? (car a) '*)
+         (list '*
+               a
+               (cons '+ (map (lambda (a) (list '/ (deriv a) a)) (cdr a)))))
+        ((equal? (car a) '/)
+         (list '-
+               (list '/ (deriv (cadr a)) (caddr a))
+               (list '/ (cadr a) (list '* (caddr a) (caddr a) (deriv (caddr a))))))
+        (else (error "deriv: no derivation method available" (car a)))))
+
+(define (repeat n)
+  (if (= n 0)
+    '()
+    (begin (deriv '(+ (* 3 x x) (* a x x) (* b x) 5))
+           (repeat (- n 1)))))
+
+(repeat 2000)
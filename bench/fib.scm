@@ -0,0 +1,10 @@
+;; doubly recursive fibonacci: procedure calls and integer arithmetic
+
+(define (fib n)
+  (if (< n 2)
+    n
+    (+ (fib (- n 1))
+       (fib (- n 2)))))
+
+(if (not (= (fib 22) 17711))
+  (error "fib: wrong result" (fib 22)))
@@ -0,0 +1,71 @@
+;; SICP's metacircular evaluator interpreting its own source, which then
+;; runs fibonacci: two interpreters on top of the interpreter
+
+(load "res/mceval.scm")
+
+;; the evaluator's source uses let, so the outer one learns it as a
+;; derived expression (SICP exercise 4.6)
+(define (let? exp) (tagged-list? exp 'let))
+(define (let->combination exp)
+  (cons (make-lambda (map car (cadr exp)) (cddr exp))
+        (map cadr (cadr exp))))
+(define eval-without-let eval)
+(define (eval exp env)
+  (if (let? exp)
+    (eval (let->combination exp) env)
+    (eval-without-let exp env)))
+
+;; sparrow's pair? is false for one element lists like (setup-environment),
+;; anything else reaching application? is a list
+(define (application? exp) (not (null? exp)))
+
+;; and its cond clauses have a single expression
+(define (eval-sequence exps env)
+  (if (last-exp? exps)
+    (eval (first-exp exps) env)
+    (begin
+      (eval (first-exp exps) env)
+      (eval-sequence (rest-exps exps) env))))
+
+;; the source also calls more primitives than the evaluator provides. the inner
+;; evaluator's primitives are outer procedures, so its underlying apply
+;; is the outer evaluator's apply
+(for-each
+  (lambda (p) (define-variable! (car p) (list 'primitive (cadr p)) the-global-environment))
+  (list (list 'apply apply) (list 'list list) (list 'length length)
+        (list 'pair? pair?) (list 'symbol? symbol?) (list 'number? number?) (list 'string? string?)
+        (list 'eq? eq?) (list 'not not) (list '= =) (list '< <) (list '+ +) (list '- -)
+        (list 'cadr cadr) (list 'cddr cddr) (list 'caddr caddr) (list 'cadddr cadddr) (list 'caadr caadr)
+        (list 'cdadr cdadr) (list 'cdddr cdddr) (list 'error error) (list 'display display)
+        (list 'newline newline)
+        (list 'set-car! (lambda (x y) (set-car! x y)))
+        (list 'set-cdr! (lambda (x y) (set-cdr! x y)))))
+
+;; map takes outer procedures, it has to be one itself
+(eval '(define (map f l) (if (null? l) '() (cons (f (car l)) (map f (cdr l)))))
+      the-global-environment)
+
+(define (mceval-load port)
+  (let ((exp (read port)))
+    (if (eof-object? exp)
+      (close-port port)
+      (begin
+        (eval exp the-global-environment)
+        (mceval-load port)))))
+(mceval-load (open-input-file "res/mceval.scm"))
+
+(eval '(begin
+         (define-variable! '+ (list 'primitive +) the-global-environment)
+         (define-variable! '- (list 'primitive -) the-global-environment)
+         (define-variable! '< (list 'primitive <) the-global-environment))
+      the-global-environment)
+(eval '(eval '(define (fib n)
+                (if (< n 2)
+                  n
+                  (+ (fib (- n 1)) (fib (- n 2)))))
+             the-global-environment)
+      the-global-environment)
+
+;; every inner step takes thousands of outer ones, a small fib is plenty
+(if (not (= (eval '(eval '(fib 2) the-global-environment) the-global-environment) 1))
+  (error "mceval: wrong result" (eval '(eval '(fib 2) the-global-environment) the-global-environment)))
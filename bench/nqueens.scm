@@ -0,0 +1,29 @@
+;; number of solutions of the n-queens problem: list building and filtering
+
+(define (iota1 n)
+  (if (= n 0)
+    '()
+    (cons n (iota1 (- n 1)))))
+
+(define (ok? row dist placed)
+  (if (null? placed)
+    #t
+    (if (= (car placed) (+ row dist))
+      #f
+      (if (= (car placed) (- row dist))
+        #f
+        (ok? row (+ dist 1) (cdr placed))))))
+
+(define (try candidates rest placed)
+  (if (null? candidates)
+    (if (null? rest) 1 0)
+    (+ (if (ok? (car candidates) 1 placed)
+         (try (append (cdr candidates) rest) '() (cons (car candidates) placed))
+         0)
+       (try (cdr candidates) (cons (car candidates) rest) placed))))
+
+(define (queens n)
+  (try (iota1 n) '() '()))
+
+(if (not (= (queens 8) 92))
+  (error "nqueens: wrong result" (queens 8)))
@@ -0,0 +1,37 @@
+#!/bin/sh
+# usage: bench/run.sh [runs] [bench/<name>.scm ...]
+#
+# runs every benchmark 'runs' times, each in a fresh interpreter, and prints
+# a tab separated table: median/min/max wall time of the benchmark itself,
+# objects and bytes it allocated, and the peak rss of the process.
+
+SPARROW=${SPARROW:-./sparrow}
+RUNS=${1:-5}
+[ $# -gt 0 ] && shift
+BENCHES=${*:-bench/*.scm}
+[ "$BENCHES" = "bench/*.scm" ] && BENCHES=$(ls bench/*.scm)
+
+samples=$(mktemp)
+trap 'rm -f "$samples"' EXIT
+
+printf 'benchmark\truns\tmedian_ns\tmin_ns\tmax_ns\tobjects\tbytes\tmaxrss_kb\n'
+for bench in $BENCHES; do
+    name=$(basename "$bench" .scm)
+    : > "$samples"
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$SPARROW" --bench "$bench" 2>&1 >/dev/null | grep '^bench' >> "$samples"
+        i=$((i + 1))
+    done
+    if [ "$(wc -l < "$samples")" -ne "$RUNS" ]; then
+        echo "$name: failed" >&2
+        exit 1
+    fi
+    sort -t "$(printf '\t')" -k 2 -n "$samples" | awk -F '\t' -v name="$name" -v runs="$RUNS" '
+        { wall[NR] = $2; objects[NR] = $3; bytes[NR] = $4; rss[NR] = $5 }
+        END {
+            m = int((NR + 1) / 2)
+            printf "%s\t%d\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%d\n", name, runs, wall[m], wall[1], wall[NR],
+                   objects[m], bytes[m], rss[m]
+        }'
+done
@@ -0,0 +1,11 @@
+;; takeuchi function: deep non-tail recursion
+
+(define (tak x y z)
+  (if (not (< y x))
+    z
+    (tak (tak (- x 1) y z)
+         (tak (- y 1) z x)
+         (tak (- z 1) x y))))
+
+(if (not (= (tak 18 12 6) 7))
+  (error "tak: wrong result" (tak 18 12 6)))
@@ -0,0 +1,72 @@
+/*
+ * sends the scheme source on stdin as one request to a --serve socket,
+ * writes the reply to stdout and exits with its status byte:
+ *   $make client && echo '(+ 1 2)' | ./client /tmp/sparrow.sock
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int read_all(int fd, char* p, size_t n) {
+    while (n) {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0) return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char* p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w <= 0) return -1;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s SOCKET < request.scm\n", argv[0]);
+        return 2;
+    }
+    size_t len = 0, cap = 4096;
+    char* src = malloc(cap);
+    for (size_t r; (r = fread(src + len, 1, cap - len, stdin)) > 0;) {
+        len += r;
+        if (len == cap) src = realloc(src, cap *= 2);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror(argv[1]);
+        return 2;
+    }
+
+    unsigned char header[4] = {len >> 24, len >> 16, len >> 8, len};
+    if (write_all(fd, (char*)header, 4) < 0 || write_all(fd, src, len) < 0 || read_all(fd, (char*)header, 4) < 0) {
+        fprintf(stderr, "%s: connection closed\n", argv[1]);
+        return 2;
+    }
+    size_t size = (size_t)header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+    char* reply = malloc(size + 1);
+    if (size == 0 || read_all(fd, reply, size) < 0) {
+        fprintf(stderr, "%s: short reply\n", argv[1]);
+        return 2;
+    }
+    fwrite(reply + 1, 1, size - 1, stdout);
+    int status = reply[0];
+    close(fd);
+    free(src);
+    free(reply);
+    return status;
+}
@@ -0,0 +1,45 @@
+/*
+ * runs an independent interpreter on each of N threads:
+ *   $make embed && ./embed 4
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparrow.h"
+
+static const char* program =
+    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+    "(map fib (list 10 15 20))";
+
+struct job {
+    pthread_t thread;
+    char* result;
+    size_t size;
+};
+
+static void* run(void* arg) {
+    struct job* job = arg;
+    sparrow_vm* vm = sparrow_create();
+    sparrow_load(vm, "./res/lib.scm");
+    FILE* out = open_memstream(&job->result, &job->size);
+    sparrow_print(vm, sparrow_eval(vm, program), out);
+    fclose(out);
+    sparrow_destroy(vm);
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 4;
+    struct job* jobs = calloc(n, sizeof(struct job));
+    for (int i = 0; i < n; i++) pthread_create(&jobs[i].thread, NULL, run, &jobs[i]);
+    int failed = 0;
+    for (int i = 0; i < n; i++) {
+        pthread_join(jobs[i].thread, NULL);
+        printf("vm %d: %s\n", i, jobs[i].result);
+        failed |= strcmp(jobs[i].result, "(55 610 6765)") != 0;
+        free(jobs[i].result);
+    }
+    free(jobs);
+    return failed;
+}
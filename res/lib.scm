@@ -95,4 +95,73 @@
 
 (define (cadr l) (car (cdr l)))
 (define (caddr l) (car (cdr (cdr l))))
+(define (cddr l) (cdr (cdr l)))
+(define (caadr l) (car (car (cdr l))))
+(define (cdadr l) (cdr (car (cdr l))))
+(define (cdddr l) (cdr (cdr (cdr l))))
+(define (cadddr l) (car (cdr (cdr (cdr l)))))
 
+
+(define (assoc key alist)
+  (cond ((null? alist) #f)
+        ((equal? key (car (car alist))) (car alist))
+        (else (assoc key (cdr alist)))))
+
+
+;; streams: a pair whose cdr is a promise, see cons-stream
+(define the-empty-stream '())
+(define (stream-null? s) (null? s))
+(define (stream-car s) (car s))
+(define (stream-cdr s) (force (cdr s)))
+
+(define (stream-ref s n)
+  (let loop ((s s) (n n))
+    (if (= n 0)
+      (stream-car s)
+      (loop (stream-cdr s) (- n 1)))))
+
+(define (stream-head s n)
+  (if (= n 0)
+    '()
+    (cons (stream-car s) (stream-head (stream-cdr s) (- n 1)))))
+
+(define (stream->list s)
+  (if (stream-null? s)
+    '()
+    (cons (stream-car s) (stream->list (stream-cdr s)))))
+
+(define (list->stream l)
+  (if (null? l)
+    the-empty-stream
+    (cons-stream (car l) (list->stream (cdr l)))))
+
+(define (stream-map proc . streams)
+  (if (stream-null? (car streams))
+    the-empty-stream
+    (cons-stream (apply proc (map stream-car streams))
+                 (apply stream-map (cons proc (map stream-cdr streams))))))
+
+(define (stream-filter pred s)
+  (let loop ((s s))
+    (cond ((stream-null? s) the-empty-stream)
+          ((pred (stream-car s))
+           (cons-stream (stream-car s) (stream-filter pred (stream-cdr s))))
+          (else (loop (stream-cdr s))))))
+
+(define (stream-for-each proc s)
+  (let loop ((s s))
+    (if (stream-null? s)
+      'done
+      (begin (proc (stream-car s))
+             (loop (stream-cdr s))))))
+
+(define (stream-enumerate-interval low high)
+  (if (> low high)
+    the-empty-stream
+    (cons-stream low (stream-enumerate-interval (+ low 1) high))))
+
+(define (integers-starting-from n)
+  (cons-stream n (integers-starting-from (+ n 1))))
+
+(define (add-streams s1 s2) (stream-map + s1 s2))
+(define (scale-stream s factor) (stream-map (lambda (x) (* x factor)) s))
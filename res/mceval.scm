@@ -352,6 +352,6 @@
 ;;;Following are commented out so as not to be evaluated when
 ;;; the file is loaded.
 (define the-global-environment (setup-environment))
-(driver-loop)
+;(driver-loop)  ;; started by 'make mceval'
 
 'METACIRCULAR-EVALUATOR-LOADED
@@ -0,0 +1,92 @@
+#!/bin/sh
+# usage: res/serve_test.sh
+#
+# starts 'sparrow --serve' in the modes it supports and checks the replies
+# to requests sent by examples/client.c. SPARROW and CLIENT override the
+# binaries; 'make test-serve' builds the server with AddressSanitizer so
+# that memory errors in a worker fail the test too.
+
+SPARROW=${SPARROW:-./sparrow}
+CLIENT=${CLIENT:-./client}
+export ASAN_OPTIONS=${ASAN_OPTIONS:-detect_leaks=0}
+
+dir=$(mktemp -d)
+sock=$dir/sock
+server=
+failed=0
+trap 'stop; rm -rf "$dir"' EXIT
+
+# serve [option ...]: start a server on $sock and wait until it answers
+serve() {
+    "$SPARROW" --serve "$sock" "$@" res/lib.scm 2>> "$dir/stderr" &
+    server=$!
+    i=0
+    until printf '' | "$CLIENT" "$sock" > /dev/null 2>&1; do
+        i=$((i + 1))
+        if [ $i -gt 100 ]; then
+            echo "server did not start" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
+
+stop() {
+    [ -n "$server" ] && kill "$server" && wait "$server"
+    server=
+}
+
+# check name status reply request: send 'request', expect 'status' and 'reply'
+check() {
+    reply=$(printf '%s' "$4" | "$CLIENT" "$sock")
+    status=$?
+    if [ "$status" = "$2" ] && [ "$reply" = "$3" ]; then
+        echo "$1 ==> pass"
+    else
+        echo "$1 ==> FAIL: status $status, reply '$reply'"
+        failed=1
+    fi
+}
+
+echo '(define loaded 1)' > "$dir/loaded.scm"
+echo '(define counter (list 0))' > "$dir/counter.scm"
+
+SPARROW_THREADS=4 serve
+check "value" 0 "3" "(+ 1 2)"
+check "output" 0 "$(printf 'hi\n3')" '(display "hi") (+ 1 2)'
+check "error" 1 "error: car: empty list" "(car '())"
+check "define" 0 "1" "(define zz 1)"
+check "define isolation" 1 "error: unbound symbol zz" "zz"
+check "load" 0 "1" "(load \"$dir/loaded.scm\") loaded"
+check "load isolation" 1 "error: unbound symbol loaded" "loaded"
+check "eval" 0 "1" "(eval '(define ev 1)) ev"
+check "eval isolation" 1 "error: unbound symbol ev" "ev"
+check "set! global" 1 "error: globals can't change in a request sum" "(set! sum product)"
+check "set! isolation" 0 "6" "(sum 2 4)"
+check "tasks" 0 "$(printf 'task\nspawned')" "(spawn (lambda () (display 'task))) 'spawned"
+check "tasks isolation" 0 "3" "(+ 1 2)"
+check "parked task" 0 "parked" "(define ch (make-channel)) (spawn (lambda () (display (receive ch)))) 'parked"
+grep -q "discarded 1 task" "$dir/stderr" || { echo "parked task ==> FAIL: not reported"; failed=1; }
+for i in 1 2 3; do  # every request has its own output port
+    check "parallel output $i" 0 "$(printf '610\n%.0s' 1 2 3 4 5 6 7 8)" \
+        '(define (f n) (if (< n 2) n (+ (f (- n 1)) (f (- n 2))))) (parallel-for-each (lambda (x) (display (f 15))) (list 1 2 3 4 5 6 7 8))'
+done
+stop
+
+serve --workers 2
+check "worker" 0 "6" "(sum 1 2 3)"
+pkill -KILL -P "$server"
+check "respawned worker" 0 "6" "(sum 1 2 3)"
+grep -q "respawning" "$dir/stderr" || { echo "respawn ==> FAIL: not reported"; failed=1; }
+stop
+
+serve --workers 1 --recycle 1 "$dir/counter.scm"
+check "set-car!" 0 "1" "(set-car! counter (+ (car counter) 1)) (car counter)"
+check "recycled worker" 0 "1" "(set-car! counter (+ (car counter) 1)) (car counter)"
+stop
+
+if grep -q "Sanitizer" "$dir/stderr"; then
+    cat "$dir/stderr" >&2
+    failed=1
+fi
+exit $failed
@@ -68,3 +68,181 @@
 (assert (eval '(sum 1 2 3)) 6)
 (assert (apply * 1 2 3 '(4 5)) 120)
 
+
+;; allocation counters
+(define (allocated) (cdr (assoc 'objects (heap-stats))))
+(define before (allocated))
+(define after (begin (list 1 2 3) (allocated)))
+(assert (< before after) #t)
+(assert (number? (cdr (assoc 'arg-lists (heap-stats)))) #t)
+
+;; clocks
+(define t0 (current-time-ns))
+(assert (< t0 (begin (fib 5) (current-time-ns))) #t)
+(assert (number? (runtime)) #t)
+(assert (length '(1 2 3)) 3)
+(assert (if #f 1) '())
+
+;; profiler: each line of the folded stacks starts with the outermost procedure,
+;; the rest reads as a comment
+(define (prof-fib n) (if (< n 2) n (+ (prof-fib (- n 1)) (prof-fib (- n 2)))))
+(profile-start)
+(prof-fib 22)
+(profile-stop "/tmp/sparrow-test.folded")
+(define (read-all port l) (let ((x (read port))) (if (eof-object? x) (begin (close-port port) l) (read-all port (cons x l)))))
+(define roots (read-all (open-input-file "/tmp/sparrow-test.folded") '()))
+(assert (< 0 (length (filter (lambda (x) (equal? x 'prof-fib)) roots))) #t)
+
+;; parallel map
+(assert (parallel-map square (list 1 2 3 4 5 6 7 8 9)) '(1 4 9 16 25 36 49 64 81))
+(assert (parallel-map (lambda (l) (apply + l)) '((1 2) (3 4) ())) '(3 7 0))
+(define counter 0)
+(assert (guard (e ((error-object? e) (error-object-message e))) (parallel-for-each (lambda (x) (set! counter (+ counter x))) '(1 2 3 4))) "globals can't change inside parallel-map")
+(assert (guard (e ((error-object? e) (error-object-message e))) (parallel-map (lambda (x) (eval (list 'define 'counter x))) '(1 2 3 4))) "globals can't change inside parallel-map")
+(assert (begin (set! counter (+ counter 1)) counter) 1)
+
+;; tasks and channels
+(define ch (make-channel))
+(define (countdown n) (send ch n) (if (= n 0) 'done (countdown (- n 1))))
+(spawn countdown 2)
+(assert (list (receive ch) (receive ch) (receive ch)) '(2 1 0))
+(define spinning #t)
+(define (spin n) (if spinning (spin (+ n 1)) (send ch n)))
+(spawn spin 0)
+(spawn (lambda () (set! spinning #f)))
+(assert (< 0 (receive ch)) #t)
+
+;; errors
+(assert (guard (e ((error-object? e) (error-object-message e))) (car '())) "car: empty list")
+(assert (guard (e ((number? e) (* e 2))) (raise 21)) 42)
+(assert (guard (e ((symbol? e) 'outer)) (guard (e ((number? e) 'inner)) (raise 'x))) 'outer)
+(assert (guard (e (else (error-object-irritants e))) (error "msg" 1 2)) '(1 2))
+(assert (guard (e ((error-object? e) (error-object-message e))) (error)) "bad arity: error needs at least 1 argument")
+(assert (with-exception-handler (lambda (e) (list 'caught e)) (lambda () (raise 'oops))) '(caught oops))
+(assert (guard (e (else 'caught)) (parallel-map (lambda (n) (/ 10 n)) '(1 0 2))) 'caught)
+(assert (guard (e ((error-object? e) (error-object-message e))) (apply car)) "bad arity: apply needs at least 2 arguments")
+(define shadowed 1)
+(define (shadow shadowed) (set! shadowed 2) shadowed)
+(assert (list (shadow 0) shadowed) '(2 1))
+
+;; let forms and loops
+(assert (let loop ((i 0) (acc '())) (if (< i 3) (loop (+ i 1) (cons i acc)) acc)) '(2 1 0))
+(assert (let loop ((i 0)) (let ((j (* 2 i))) (cond ((< i 5000) (loop (+ i 1))) (else j)))) 10000)
+(assert (do ((i 0 (+ i 1)) (s 0 (+ s i))) ((= i 5) s)) 10)
+(assert (map (lambda (f) (f)) (do ((i 0 (+ i 1)) (l '() (cons (lambda () i) l))) ((= i 3) l))) '(2 1 0))
+(assert (let* ((x 1) (y (+ x 1))) (list x y)) '(1 2))
+(assert (letrec ((ev? (lambda (n) (if (= n 0) #t (od? (- n 1))))) (od? (lambda (n) (if (= n 0) #f (ev? (- n 1)))))) (ev? 10)) #t)
+
+;; ports
+(define port (open-input-file "res/mceval.scm"))
+(assert (read port) '(define apply-in-underlying-scheme apply))
+(define (count-forms port n) (if (eof-object? (read port)) (begin (close-port port) n) (count-forms port (+ n 1))))
+(assert (count-forms port 1) 81)
+(assert (guard (e (else (error-object-message e))) (open-input-file "no/such/file")) "open-input-file: No such file or directory")
+
+;; promises and streams
+(define forced 0)
+(define p (delay (begin (set! forced (+ forced 1)) forced)))
+(assert (list (promise? p) (force p) (force p) forced) '(#t 1 1 1))
+(assert (force 5) 5)
+(define forced-shared (list 0))  ;; parallel-map can't set! globals
+(define shared (delay (begin (set-car! forced-shared (+ (car forced-shared) 1)) (fib 15))))
+(assert (parallel-map (lambda (x) (force shared)) '(1 2 3 4 5 6 7 8)) '(987 987 987 987 987 987 987 987))
+(assert forced-shared '(1))
+(define failing (delay (begin (set! forced (+ forced 1)) (car '()))))
+(assert (list (guard (e (else 'retried)) (force failing)) (guard (e (else forced)) (force failing))) '(retried 3))
+(define pch (make-channel))
+(define parked (delay (receive pch)))
+(spawn force parked)
+(yield)
+(assert (guard (e ((error-object? e) (error-object-message e))) (force parked)) "deadlock: the task forcing the promise can't run")
+(send pch 'sent)
+(assert (force parked) 'sent)
+(define fibs (cons-stream 0 (cons-stream 1 (add-streams (stream-cdr fibs) fibs))))
+(assert (stream-ref fibs 40) 102334155)
+(define (sieve s) (cons-stream (stream-car s) (sieve (stream-filter (lambda (x) (not (= 0 (mod x (stream-car s))))) (stream-cdr s)))))
+(assert (stream-head (sieve (integers-starting-from 2)) 6) '(2 3 5 7 11 13))
+(assert (stream-ref (scale-stream (integers-starting-from 0) 2) 20000) 40000)
+(assert (stream->list (stream-map + (list->stream '(1 2)) (stream-enumerate-interval 10 11))) '(11 13))
+
+;; memoization
+(assert (equal? '(1 2) '(1 3)) #f)
+(define-memoized (mfib n) (if (< n 2) n (+ (mfib (- n 1)) (mfib (- n 2)))))
+(assert (mfib 40) 102334155)
+(assert (map (lambda (k) (cdr (assoc k (memo-stats mfib)))) '(hits misses size capacity)) '(38 41 41 1024))
+(define-memoized (mdouble n) #:capacity 3 (* n 2))
+(assert (map mdouble '(1 2 3 4 5 1)) '(2 4 6 8 10 2))
+(assert (map (lambda (k) (cdr (assoc k (memo-stats mdouble)))) '(hits misses size capacity)) '(0 6 3 3))
+(assert (guard (e ((error-object? e) (error-object-message e))) (define-memoized (mzero n) #:capacity 0 n)) "define-memoized: capacity must be positive")
+(define calls 0)
+(define msq (memoize (lambda (l) (begin (set! calls (+ calls 1)) (map (lambda (x) (* x x)) l))) 2))
+(assert (list (msq '(1 2)) (msq (list 1 2)) calls) '((1 4) (1 4) 1))
+(msq '(3))
+(msq '(4))
+(assert (list (msq '(1 2)) calls) '((1 4) 4))
+(memo-clear! msq)
+(assert (map cdr (memo-stats msq)) '(0 0 0 2))
+(assert (parallel-map (memoize (lambda (n) (* n 2))) '(1 2 1 2)) '(2 4 2 4))
+
+;; optimizer
+(define (opt-fold) (if #t (+ 1 2) (car '())))
+(assert (opt-fold) 3)
+(define (opt-div) (/ 1 0))
+(assert (guard (e (else 'raised)) (opt-div)) 'raised)
+(define (opt-sq x) (* x x))
+(define (opt-use n) (opt-sq (+ n 1)))
+(assert (opt-use 2) 9)
+(define (opt-sq x) (+ x x))
+(assert (opt-use 2) 6)
+(set! opt-sq (lambda (x) 0))
+(assert (opt-use 2) 0)
+(define (opt-shadow opt-sq) (opt-sq 3))
+(assert (opt-shadow (lambda (x) 'local)) 'local)
+(define opt-n 0)
+(define (opt-twice x) (+ x x))
+(assert (opt-twice (begin (set! opt-n (+ opt-n 1)) opt-n)) 2)
+(define (opt-inc x) (+ x 1))
+(define (opt-inc2 x) (opt-inc (opt-inc x)))
+(define (opt-inc4 x) (opt-inc2 (opt-inc2 x)))
+(assert (opt-inc4 0) 4)
+(define (opt-inc x) (+ x 10))
+(assert (opt-inc4 0) 40)
+(define opt-add10 opt-inc)
+(define opt-dbl (lambda (x) (* x 2)))
+(define (opt-via-alias x) (opt-add10 (opt-dbl x)))
+(assert (opt-via-alias 1) 12)
+(define (opt-base x) (* x 2))
+(define (opt-mid x) (opt-base x))
+(define opt-mid-alias opt-mid)
+(define (opt-top x) (opt-mid-alias x))
+(define (opt-base x) (* x 3))
+(define (opt-inc x) (+ x 100))
+(assert (list (opt-via-alias 1) (opt-top 1)) '(12 3))
+
+;; macros
+(define-syntax swap! (syntax-rules () ((_ a b) (let ((tmp a)) (begin (set! a b) (set! b tmp))))))
+(define tmp 1)
+(define other 2)
+(swap! tmp other)
+(assert (list tmp other) '(2 1))
+(define-syntax my-or (syntax-rules () ((_) #f) ((_ e) e) ((_ e r ...) (let ((t e)) (if t t (my-or r ...))))))
+(assert (let ((t 5)) (my-or #f t)) 5)
+(define-syntax kv (syntax-rules () ((_ (k v) ...) (list (cons 'k v) ...))))
+(assert (kv (a 1) (b 2)) (list (cons 'a 1) (cons 'b 2)))
+(define-syntax for (syntax-rules (in) ((_ x in l body) (map (lambda (x) body) l))))
+(assert (for y in '(1 2 3) (* y y)) '(1 4 9))
+(define-macro (my-unless c . body) (list 'if c #f (cons 'begin body)))
+(define (count-to n) (let loop ((k 0)) (my-unless (= k n) (loop (+ k 1)))))
+(assert (count-to 100000) #f)
+(define-syntax thunk (syntax-rules () ((_ e) (lambda () e))))
+(define (thunks n) (do ((i 0 (+ i 1)) (l '() (cons (thunk i) l))) ((= i n) l)))
+(assert (map (lambda (f) (f)) (thunks 3)) '(2 1 0))
+(define (use-swap x y) (begin (swap! x y) (list x y)))
+(assert (use-swap 1 2) '(2 1))
+(define-syntax swap! (syntax-rules () ((_ a b) #f)))
+(assert (use-swap 1 2) '(1 2))
+(assert (map (lambda (x) (eval (list 'my-or #f x))) '(1 2)) '(1 2))
+(eval (list 'define (list 'built-or 'x) (list 'my-or #f 'x)))
+(assert (list (built-or 3) (built-or 4)) '(3 4))
+(define-syntax first-of-two (syntax-rules () ((_ a b) a)))
+(assert (guard (e (else (error-object-message e))) (first-of-two 1)) "no syntax-rules pattern matches")
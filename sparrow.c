@@ -6,20 +6,41 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <ctype.h>
-
-typedef struct object* (*primitive_t)(struct object* args);
-typedef struct object* (*syntax_t)(struct object*, struct object* );
+#include <getopt.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <setjmp.h>
+#include "sparrow.h"
+
+typedef struct object* (*primitive_t)(struct sparrow_vm* vm, struct object* args);
+typedef struct object* (*syntax_t)(struct sparrow_vm* vm, struct object*, struct object* );
 
 struct object {
     enum {
-        BOOLEAN, NUMBER, SYMBOL, STRING, PORT, LIST, PROCEDURE, PRIMITIVE, ENVIRONMENT, SYNTAX
+        BOOLEAN, NUMBER, SYMBOL, STRING, PORT, LIST, PROCEDURE, PRIMITIVE, ENVIRONMENT, SYNTAX,
+        TASK, CHANNEL, ERROR, PROMISE, MEMOIZED, MACRO
     } type;
+    bool source;  // LIST read, in a procedure body or expanded from those: caches may key on it
     union {
         bool b;
         int64_t integer;
         struct {
             char* s;  // STRING or SYMBOL
             struct object* next;
+            struct object* global;  // SYMBOL: the cell of its value in the global frame
         };
         FILE* stream;
         struct {  // LIST
@@ -41,113 +62,303 @@ struct object {
             struct object* frame;  // ((vars), (vals))
             struct object* parent;  // parent env
         };
+        struct task* task;
+        struct channel* channel;
+        struct {  // ERROR
+            struct object* message;  // STRING
+            struct object* irritants;
+        };
+        struct {  // PROMISE
+            struct object* delayed;  // the expression, its value once forced
+            struct object* delayed_env;
+            bool forced;
+            struct task* forcer;  // evaluating it, until it is forced
+        };
+        struct memo* memo;
+        struct {  // MACRO
+            struct object* expander;  // procedure of define-macro, or
+            struct object* literals;  // the literals and rules of syntax-rules
+            struct object* rules;
+        };
     };
 };
+#define N_TYPES (MACRO + 1)
 
-static struct {
-    struct object** table;
-    int size;
-} g_sym_table;
-static struct object* the_global_environment = NULL;
-static struct object* g_true = NULL;
-static struct object* g_false = NULL;  // the only 'false'
 static struct object* g_dummy = (struct object*)(-1);  // dummy obj
+static struct object* g_loop = (struct object*)(-2);  // go around again, see eval_loop
 #define newline() putchar('\n')
-#define PRINT(exp) do { \
-    newline(); print(exp); newline(); \
-} while(0)
 #define CHECK_ARITY(exp, num) do { \
-    if (len(cdr(exp)) != num) { \
-        printf("bad arity: "); print(car(exp)); printf(" needs %d arguments\n", num); \
-        abort(); \
+    if (len(vm, cdr(exp)) != num) { \
+        raise_error(vm, NULL, "bad arity: %s needs %d arguments", car(exp)->prim_name->s, num); \
     } \
 } while (0)
 static const char* types_str[] = \
-{"boolean", "number", "symbol", "string", "port", "list", "procedure", "primitive","environmen", "syntax"};
+{"boolean", "number", "symbol", "string", "port", "list", "procedure", "primitive", "environment", "syntax",
+ "task", "channel", "error", "promise", "memoized", "macro"};
 #define REQUIRE(exp, TYPE) do { \
     if ((!exp && TYPE != LIST) || (exp && exp->type != TYPE)) { \
-        printf("require type: %s, but exp has type: %s\n", types_str[TYPE], \
-                exp ? types_str[exp->type] :  types_str[LIST]);\
-        assert(0); \
+        raise_error(vm, list(vm, 1, exp), "require type: %s, but exp has type: %s", types_str[TYPE], \
+                exp ? types_str[exp->type] :  types_str[LIST]); \
     } \
 } while(0)
 
-struct object* read_exp(FILE* fp);
-struct object* eval(struct object* exp, struct object* env);
+// call stack of applications, maintained by eval_list (see push_frame)
+struct call_frame {
+    struct object* name;  // name of the applied procedure/primitive
+    struct call_frame* prev;
+};
+
+struct prof_proc {
+    struct object* name;
+    long calls, self, total;
+    long mark;  // last sample that counted towards total
+};
+struct prof_node {
+    struct object* name;
+    int parent;
+    long samples;  // samples with this node on top of the stack
+};
+
+// where raise_object returns to, see errors
+struct handler {
+    jmp_buf jmp;
+    struct handler* prev;
+    struct call_frame* frames;  // the call stack when it was pushed
+};
+
+// a green thread, see tasks
+struct task {
+    ucontext_t ctx;
+    char* stack;  // NULL for the main task
+    struct call_frame* frames;  // its call stack while switched out
+    struct handler* handlers;  // and its error handlers
+    struct object* func;
+    struct object* args;
+    struct object* value;  // handed over by send to a parked receiver
+    struct object* error;  // or raised in it instead
+    struct channel* waiting;  // parked on
+    struct task* next;  // in the ready queue or among a channel's receivers
+    struct task* link;  // in vm->sched.tasks
+    struct sparrow_vm* vm;  // that runs it
+    struct object* awaiting;  // a promise another task is forcing, see force
+    bool done;  // finished, or discarded by sched_drain
+    long id;
+};
+struct channel {
+    struct object *head, *tail;  // values nobody received yet
+    struct task *receivers, *receivers_tail;  // parked on this channel
+};
+
+// the cached results of a procedure, see memoization
+#define MEMO_CAPACITY 1024  // of define-memoized
+struct memo_entry {
+    struct object* args;
+    struct object* value;
+    unsigned long hash;
+    struct memo_entry* next;  // in its bucket
+    struct memo_entry *newer, *older;  // in the lru list
+};
+struct memo {
+    struct object* func;
+    struct memo_entry** buckets;
+    int n_buckets, count, capacity;
+    struct memo_entry *newest, *oldest;
+    long hits, misses;
+    pthread_mutex_t lock;  // parallel-map workers may call it too
+};
+
+// pointer keyed open addressing, see table_slot
+struct table {
+    struct object** keys;
+    struct object** values;
+    int size, count;
+};
+
+// objects are carved out of chunks, which are freed by sparrow_destroy
+#define CHUNK_OBJECTS 4096
+struct chunk {
+    struct chunk* next;
+    int used;
+    struct object objects[CHUNK_OBJECTS];
+};
+
+/*
+ * all the state of one interpreter. nothing is shared between vms, so
+ * independent interpreters can run on different threads. the workers of
+ * parallel-map are the exception: they run with copies of their owner's
+ * vm, sharing its symbol table and global environment.
+ */
+struct sparrow_vm {
+    struct {
+        struct object** table;
+        int size;
+    } sym_table;
+    pthread_mutex_t sym_lock;  // taken by mk_sym once there are workers
+    pthread_mutex_t promise_lock;  // of the promises forced by this vm and its workers
+    pthread_cond_t promise_forced;  // see force
+    struct sparrow_vm* owner;  // for workers: the vm they evaluate for
+    struct pool* pool;  // workers of parallel-map, created on first use
+    int parallel;  // parallel-map calls in progress, which keep globals as they are
+    struct object* global_env;
+    struct object* top_env;  // where load and eval go: global_env, or the env of a request
+    struct object* true_obj;
+    struct object* false_obj;  // the only 'false'
+    struct object* eof_obj;  // read at the end of a port
+    struct {  // symbols used by the evaluator itself
+        struct object *dot, *begin, *lambda, *quote, *define, *let, *delay, *cons_stream, *define_memoized;
+        struct object *ellipsis, *underscore, *capacity;
+    } sym;
+    struct table forms;  // facts about forms, computed once per form
+    struct table deps;  // global -> ((procedure . source) ...), see optimizer
+    struct table expansions;  // call site -> (macro . expansion), see macros
+    long gensyms;  // names made by gensym, counted by the owner of workers
+    struct chunk* chunks;
+    char read_buf[256];  // string literals being read
+    FILE* out;  // output of display, newline and the repl
+    struct call_frame* volatile frames;
+    struct handler* handlers;  // innermost first
+    struct object* raised;  // for the handler that catches it
+    struct object* error;  // see sparrow_error
+    struct {  // allocation counters, see (heap-stats)
+        long objects[N_TYPES];  // per type
+        long bytes[N_TYPES];
+        long arg_lists;  // argument lists built by eval_args
+        long arg_conses;
+    } heap;
+    struct {  // see profiler
+        volatile sig_atomic_t active;
+        bool busy;  // a thread is adding a sample
+        struct prof_proc* procs;
+        struct prof_node* nodes;
+        int* index;  // (parent, name) -> node + 1
+        int n_nodes;
+        long samples, dropped;
+    } prof;
+    struct {  // see tasks
+        struct task main;  // the evaluation that spawned the first task
+        struct task* current;  // NULL until then
+        struct task *ready, *ready_tail;
+        struct task* finished;  // whose stack is recycled once we are off it
+        struct task* tasks;  // spawned since the last sched_drain
+        char** stacks;  // free stacks
+        int n_stacks, cap_stacks;
+        long n_tasks;
+        int budget;  // eval steps left before the current task is preempted
+        bool spawned;  // by spawn, only then does eval check for preemption
+    } sched;
+};
+
+struct object* read_exp(struct sparrow_vm* vm, FILE* fp);
+struct object* eval(struct sparrow_vm* vm, struct object* exp, struct object* env);
+struct object* apply(struct sparrow_vm* vm, struct object* func, struct object* args);
+struct object* parallel_map(struct sparrow_vm* vm, struct object* func, struct object* l);
+void raise_object(struct sparrow_vm* vm, struct object* o) __attribute__((noreturn));
+void raise_error(struct sparrow_vm* vm, struct object* irritants, const char* fmt, ...)
+    __attribute__((noreturn, format(printf, 3, 4)));
+int len(struct sparrow_vm* vm, struct object* l);
+struct object* spawn(struct sparrow_vm* vm, struct object* func, struct object* args);
+void task_yield(struct sparrow_vm* vm);
+void sched_drain(struct sparrow_vm* vm);
+struct object* mk_channel(struct sparrow_vm* vm);
+void channel_send(struct sparrow_vm* vm, struct channel* ch, struct object* val);
+struct object* channel_receive(struct sparrow_vm* vm, struct channel* ch);
+struct object* mk_memoized(struct sparrow_vm* vm, struct object* func, int capacity);
+struct object* memo_apply(struct sparrow_vm* vm, struct object* func, struct object* args);
+struct object* memo_stats(struct sparrow_vm* vm, struct memo* m);
+void memo_clear(struct memo* m);
+void optimize(struct sparrow_vm* vm, struct object* proc);
+void deoptimize(struct sparrow_vm* vm, struct object* var);
+struct object* expansion(struct sparrow_vm* vm, struct object* macro, struct object* form);
+void mark_source(struct object* exp);
 void print(struct object* o);
+void fprint(FILE* out, struct object* o);
 
 /*========================================================
  * constructors
  * =======================================================*/
-struct object* mk_obj(int t)
+struct object* mk_obj(struct sparrow_vm* vm, int t)
 {
-    struct object* o = malloc(sizeof(struct object));
+    if (!vm->chunks || vm->chunks->used == CHUNK_OBJECTS) {
+        struct chunk* c = malloc(sizeof(struct chunk));
+        c->next = vm->chunks;
+        c->used = 0;
+        vm->chunks = c;
+    }
+    struct object* o = &vm->chunks->objects[vm->chunks->used++];
     memset(o, 0, sizeof(struct object));
     o->type = t;
+    vm->heap.objects[t]++;
+    vm->heap.bytes[t] += sizeof(struct object);
     return o;
 }
 
-struct object* mk_bool(bool b) {
-    struct object* o = mk_obj(BOOLEAN);
+struct object* mk_bool(struct sparrow_vm* vm, bool b) {
+    struct object* o = mk_obj(vm, BOOLEAN);
     o->b = b;
     return o;
 }
 
-struct object* mk_integer(int64_t x) {
-    struct object* o = mk_obj(NUMBER);
+struct object* mk_integer(struct sparrow_vm* vm, int64_t x) {
+    struct object* o = mk_obj(vm, NUMBER);
     o->integer = x;
     return o;
 }
 
 extern char* strdup(const char*);
-struct object* mk_str(const char* s) {
-    struct object* o = NULL;
-    if (s) {
-        o = mk_obj(STRING);
-        o->s = strdup(s);
-        o->next = NULL;
-    }
+static struct object* mk_text(struct sparrow_vm* vm, int t, const char* s) {
+    struct object* o = mk_obj(vm, t);
+    o->s = strdup(s);
+    o->next = NULL;
+    vm->heap.bytes[t] += strlen(s) + 1;
     return o;
 }
 
-static unsigned long long hash(const char* str) {
+struct object* mk_str(struct sparrow_vm* vm, const char* s) {
+    return s ? mk_text(vm, STRING, s) : NULL;
+}
+
+static unsigned long long hash(const char* str, int size) {
     // check [here](http://www.cse.yorku.ca/~oz/hash.html)
     unsigned long long hash = 5381;
     int c;
     while ((c = *str++)) {
         hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
     }
-    return hash % g_sym_table.size;  // collision is possible
+    return hash % size;  // collision is possible
 }
 
-struct object* mk_sym(const char* s) {
-    unsigned long long k = hash(s);
-    struct object* o = g_sym_table.table[k];
+struct object* mk_sym(struct sparrow_vm* vm, const char* s) {
+    unsigned long long k = hash(s, vm->sym_table.size);
+    struct sparrow_vm* root = vm->owner ? vm->owner : vm;
+    bool shared = root->pool != NULL;
+    if (shared) pthread_mutex_lock(&root->sym_lock);
+    struct object* o = vm->sym_table.table[k];
     if (!o) {
-        o = mk_str(s);
-        o->type = SYMBOL;
-        g_sym_table.table[k] = o;
+        o = mk_text(vm, SYMBOL, s);
+        vm->sym_table.table[k] = o;
     } else {
         while (o) {  // solve collision
-            if (!strcmp(o->s, s)) return o;
+            if (!strcmp(o->s, s)) break;
             o = o->next;
         }
-        o = mk_str(s);
-        o->type = SYMBOL;
-        o->next = g_sym_table.table[k];
-        g_sym_table.table[k] = o;
+        if (!o) {
+            o = mk_text(vm, SYMBOL, s);
+            o->next = vm->sym_table.table[k];
+            vm->sym_table.table[k] = o;
+        }
     }
+    if (shared) pthread_mutex_unlock(&root->sym_lock);
     return o;
 }
 
-struct object* cons(struct object*  x, struct object* y) {
-    struct object* o = mk_obj(LIST);
+struct object* cons(struct sparrow_vm* vm, struct object*  x, struct object* y) {
+    struct object* o = mk_obj(vm, LIST);
     o->car = x;
     o->cdr = y;
     return o;
 }
 
-struct object* list(const unsigned int num, ...) {
+struct object* list(struct sparrow_vm* vm, const unsigned int num, ...) {
     if (!num) return NULL;
     struct object **l = malloc(sizeof(struct object*) * num);
     va_list valist;
@@ -158,38 +369,58 @@ struct object* list(const unsigned int num, ...) {
     va_end(valist);
     struct object* ret = NULL;
     for (int i = num - 1; i >= 0; i--) {
-        ret = cons(l[i], ret);
+        ret = cons(vm, l[i], ret);
     }
     free(l);
     return ret;
 }
 
-struct object* mk_procedure(char* name, struct object* params, struct object* body, struct object* env) {
-    struct object* o = mk_obj(PROCEDURE);
+struct object* mk_procedure(struct sparrow_vm* vm, struct object* name, struct object* params, struct object* body, struct object* env) {
+    struct object* o = mk_obj(vm, PROCEDURE);
     o->params = params;
     o->body = body;
     o->env = env;
-    o->name = mk_sym(name);
+    o->name = name;
     return o;
 }
 
-struct object* mk_prim(char* name, primitive_t prim) {
-    struct object* o = mk_obj(PRIMITIVE);
+struct object* mk_prim(struct sparrow_vm* vm, char* name, primitive_t prim) {
+    struct object* o = mk_obj(vm, PRIMITIVE);
     o->primitive = prim;
-    o->prim_name = mk_sym(name);
+    o->prim_name = mk_sym(vm, name);
+    return o;
+}
+
+struct object* mk_error(struct sparrow_vm* vm, struct object* message, struct object* irritants) {
+    struct object* o = mk_obj(vm, ERROR);
+    o->message = message;
+    o->irritants = irritants;
+    return o;
+}
+
+struct object* mk_promise(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    struct object* o = mk_obj(vm, PROMISE);
+    o->delayed = exp;
+    o->delayed_env = env;
     return o;
 }
 
-struct object* mk_env(struct object* parent) {
-    struct object* new_env = mk_obj(ENVIRONMENT);
-    new_env->frame = cons(NULL, NULL);
+struct object* mk_port(struct sparrow_vm* vm, FILE* stream) {
+    struct object* o = mk_obj(vm, PORT);
+    o->stream = stream;
+    return o;
+}
+
+struct object* mk_env(struct sparrow_vm* vm, struct object* parent) {
+    struct object* new_env = mk_obj(vm, ENVIRONMENT);
+    new_env->frame = cons(vm, NULL, NULL);
     new_env->parent = parent;
     return new_env;
 }
 
-struct object* mk_syntax(syntax_t p)
+struct object* mk_syntax(struct sparrow_vm* vm, syntax_t p)
 {
-    struct object* o = mk_obj(SYNTAX);
+    struct object* o = mk_obj(vm, SYNTAX);
     o->syntax = p;
     return o;
 }
@@ -201,12 +432,14 @@ struct object* cadr(struct object* l) {return l->cdr->car;}
 struct object* cdar(struct object* l) {return l->car->cdr;}
 struct object* cddr(struct object* l) {return l->cdr->cdr;}
 struct object* caddr(struct object* l) {return l->cdr->cdr->car;}
+struct object* cdddr(struct object* l) {return l->cdr->cdr->cdr;}
 
 /*========================================================
  * environment handling
  * =======================================================*/
 struct object* lookup_variable(struct object* var, struct object* env) {
     while (env) {
+        if (!env->parent) return var->global ? car(var->global) : g_dummy;  // see define_variable
         struct object* frame = env->frame;
         struct object* vars = car(frame);
         struct object* vals = cdr(frame);
@@ -220,27 +453,42 @@ struct object* lookup_variable(struct object* var, struct object* env) {
     return g_dummy;  // unbound variable
 }
 
-struct object* set_variable(struct object* var, struct object* val, struct object* env) {
+// parallel-map workers read globals without taking locks, and a request
+// to --serve leaves them as they are for the next ones
+static void require_global_write(struct sparrow_vm* vm, struct object* var) {
+    if (vm->owner || vm->parallel) raise_error(vm, list(vm, 1, var), "globals can't change inside parallel-map");
+    if (vm->top_env != vm->global_env) raise_error(vm, list(vm, 1, var), "globals can't change in a request");
+}
+
+struct object* set_variable(struct sparrow_vm* vm, struct object* var, struct object* val, struct object* env) {
     REQUIRE(var, SYMBOL);
-    while (env) {
+    for (; env->parent; env = env->parent) {
         struct object* frame = env->frame;
         struct object* vars = car(frame);
         struct object* vals = cdr(frame);
         while (vars) {
             if (var == car(vars)) {
                 vals->car = val;
-                break;
+                return val;
             }
             vars = cdr(vars);
             vals = cdr(vals);
         }
-        env = cdr(env);
     }
-    return val;
+    if (!var->global) raise_error(vm, list(vm, 1, var), "unbound symbol");
+    require_global_write(vm, var);
+    deoptimize(vm, var);
+    return var->global->car = val;
 }
 
-// define variable in *current* frame
-struct object* define_variable(struct object* var, struct object* val, struct object* env) {
+// define variable in *current* frame. a symbol keeps the cell of its
+// global value, so looking up a global doesn't walk the global frame
+struct object* define_variable(struct sparrow_vm* vm, struct object* var, struct object* val, struct object* env) {
+    if (env == vm->global_env) {
+        require_global_write(vm, var);
+        deoptimize(vm, var);
+        if (var->global) return var->global->car = val;
+    }
     struct object* frame = env->frame;
     struct object* vars = car(frame);
     struct object* vals = cdr(frame);
@@ -249,33 +497,328 @@ struct object* define_variable(struct object* var, struct object* val, struct ob
         vars = cdr(vars);
         vals = cdr(vals);
     }
-    frame->car = cons(var, car(frame));
-    frame->cdr = cons(val, cdr(frame));
+    frame->car = cons(vm, var, car(frame));
+    frame->cdr = cons(vm, val, cdr(frame));
+    if (env == vm->global_env) var->global = frame->cdr;
     return val;
 }
 
+/*========================================================
+ * profiler
+ * =======================================================*/
+/*
+ * SIGPROF samples the call stack (vm->frames) every PROF_INTERVAL_US of cpu
+ * time. each sampled stack is stored in a trie of (parent, name) nodes, so
+ * the handler never allocates; call counts are kept by push_frame.
+ *
+ * the timer and the handler belong to the process: they are shared by the
+ * vms profiling at the same time and torn down after the last one stops.
+ * parallel-map workers sample and count calls into their owner's profile.
+ */
+#define PROF_INTERVAL_US 1000
+#define PROF_MAX_PROCS 4096  // power of 2
+#define PROF_MAX_NODES 65536  // power of 2
+#define PROF_MAX_DEPTH 256
+static __thread struct sparrow_vm* volatile prof_vm;  // vm being sampled on this thread
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static int prof_users;  // vms profiling, taken with prof_lock
+
+static unsigned long prof_hash(const void* p, int parent) {
+    unsigned long h = (unsigned long)(uintptr_t)p >> 4;
+    return (h ^ (h >> 15) ^ ((unsigned long)parent * 2654435761UL)) * 2654435761UL;
+}
+
+// workers may add procedures concurrently
+static struct prof_proc* prof_proc(struct sparrow_vm* vm, struct object* name) {
+    unsigned long i = prof_hash(name, 0);
+    for (int n = 0; n < PROF_MAX_PROCS; n++, i++) {
+        struct prof_proc* p = &vm->prof.procs[i & (PROF_MAX_PROCS - 1)];
+        struct object* seen = __atomic_load_n(&p->name, __ATOMIC_RELAXED);
+        if (!seen && __atomic_compare_exchange_n(&p->name, &seen, name, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return p;
+        }
+        if (seen == name) return p;
+    }
+    return NULL;  // table is full
+}
+
+static int prof_child(struct sparrow_vm* vm, int parent, struct object* name) {
+    unsigned long i = prof_hash(name, parent);
+    for (int n = 0; n < 2 * PROF_MAX_NODES; n++, i++) {
+        int* slot = &vm->prof.index[i & (2 * PROF_MAX_NODES - 1)];
+        if (!*slot) {
+            if (vm->prof.n_nodes == PROF_MAX_NODES) return -1;
+            struct prof_node* node = &vm->prof.nodes[vm->prof.n_nodes];
+            node->name = name;
+            node->parent = parent;
+            node->samples = 0;
+            *slot = ++vm->prof.n_nodes;
+            return *slot - 1;
+        }
+        struct prof_node* node = &vm->prof.nodes[*slot - 1];
+        if (node->parent == parent && node->name == name) return *slot - 1;
+    }
+    return -1;
+}
+
+static void prof_sample(int sig) {
+    struct sparrow_vm* vm = prof_vm;
+    if (!vm) return;  // a thread without a vm was interrupted
+    struct sparrow_vm* root = vm->owner ? vm->owner : vm;
+    if (!root->prof.active) return;
+    if (__atomic_test_and_set(&root->prof.busy, __ATOMIC_ACQUIRE)) {  // can't wait in a handler
+        if (root->prof.active) __atomic_fetch_add(&root->prof.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (!root->prof.active) {  // stopped while we took it, prof_wait may be done
+        __atomic_clear(&root->prof.busy, __ATOMIC_RELEASE);
+        return;
+    }
+    // only the innermost PROF_MAX_DEPTH frames are kept
+    struct object* stack[PROF_MAX_DEPTH];
+    int depth = 0;
+    for (struct call_frame* f = vm->frames; f && depth < PROF_MAX_DEPTH; f = f->prev) {
+        stack[depth++] = f->name;
+    }
+    int node = 0;  // root
+    while (depth--) {
+        if ((node = prof_child(root, node, stack[depth])) < 0) break;
+    }
+    if (node < 0) {
+        root->prof.dropped++;
+    } else {
+        root->prof.nodes[node].samples++;
+        root->prof.samples++;
+    }
+    __atomic_clear(&root->prof.busy, __ATOMIC_RELEASE);
+}
+
+// wait for a sample being added by another thread. 'active' is cleared
+// first: a sample taking 'busy' after this returns sees it and gives up
+static void prof_wait(struct sparrow_vm* vm) {
+    while (__atomic_test_and_set(&vm->prof.busy, __ATOMIC_ACQUIRE)) sched_yield();
+    __atomic_clear(&vm->prof.busy, __ATOMIC_RELEASE);
+}
+
+static void prof_start(struct sparrow_vm* vm) {
+    bool started = vm->prof.active;
+    vm->prof.active = 0;
+    prof_wait(vm);
+    if (!vm->prof.procs) {
+        vm->prof.procs = malloc(sizeof(struct prof_proc) * PROF_MAX_PROCS);
+        vm->prof.nodes = malloc(sizeof(struct prof_node) * PROF_MAX_NODES);
+        vm->prof.index = malloc(sizeof(int) * 2 * PROF_MAX_NODES);
+    }
+    memset(vm->prof.procs, 0, sizeof(struct prof_proc) * PROF_MAX_PROCS);
+    memset(vm->prof.index, 0, sizeof(int) * 2 * PROF_MAX_NODES);
+    vm->prof.nodes[0] = (struct prof_node){NULL, -1, 0};
+    vm->prof.n_nodes = 1;
+    vm->prof.samples = vm->prof.dropped = 0;
+    vm->prof.active = 1;
+    prof_vm = vm;
+    if (started) return;
+
+    pthread_mutex_lock(&prof_lock);
+    if (prof_users++ == 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = prof_sample;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGPROF, &sa, NULL);
+        struct itimerval timer = {{0, PROF_INTERVAL_US}, {0, PROF_INTERVAL_US}};
+        setitimer(ITIMER_PROF, &timer, NULL);
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+static int prof_cmp(const void* a, const void* b) {
+    const struct prof_proc* x = a;
+    const struct prof_proc* y = b;
+    if (x->self != y->self) return x->self < y->self ? 1 : -1;
+    return x->total < y->total ? 1 : (x->total > y->total ? -1 : 0);
+}
+
+// write the sampled stacks in the 'folded' format of flamegraph.pl
+static void prof_write_folded(struct sparrow_vm* vm, FILE* fp) {
+    for (int i = 1; i < vm->prof.n_nodes; i++) {
+        if (!vm->prof.nodes[i].samples) continue;
+        struct object* path[PROF_MAX_DEPTH];
+        int depth = 0;
+        for (int n = i; n > 0; n = vm->prof.nodes[n].parent) path[depth++] = vm->prof.nodes[n].name;
+        while (depth--) fprintf(fp, "%s%c", path[depth]->s, depth ? ';' : ' ');
+        fprintf(fp, "%ld\n", vm->prof.nodes[i].samples);
+    }
+}
+
+// stop sampling and print the per-procedure report to 'out'
+static void prof_stop(struct sparrow_vm* vm, FILE* out, const char* folded) {
+    if (!vm->prof.active) return;
+    vm->prof.active = 0;
+    prof_wait(vm);
+    pthread_mutex_lock(&prof_lock);
+    if (--prof_users == 0) {
+        struct itimerval timer = {{0, 0}, {0, 0}};
+        setitimer(ITIMER_PROF, &timer, NULL);
+        signal(SIGPROF, SIG_IGN);
+    }
+    pthread_mutex_unlock(&prof_lock);
+    prof_vm = NULL;
+
+    // self time comes from the top of each stack, inclusive time from
+    // every distinct procedure on it
+    for (int i = 1; i < vm->prof.n_nodes; i++) {
+        struct prof_node* node = &vm->prof.nodes[i];
+        if (!node->samples) continue;
+        struct prof_proc* p = prof_proc(vm, node->name);
+        if (p) p->self += node->samples;
+        for (int n = i; n > 0; n = vm->prof.nodes[n].parent) {
+            if (!(p = prof_proc(vm, vm->prof.nodes[n].name)) || p->mark == i) continue;
+            p->mark = i;
+            p->total += node->samples;
+        }
+    }
+    int count = 0;
+    for (int i = 0; i < PROF_MAX_PROCS; i++) {
+        if (vm->prof.procs[i].name) vm->prof.procs[count++] = vm->prof.procs[i];
+    }
+    qsort(vm->prof.procs, count, sizeof(struct prof_proc), prof_cmp);
+
+    double ms = PROF_INTERVAL_US / 1000.0;
+    long samples = vm->prof.samples ? vm->prof.samples : 1;
+    fprintf(out, ";; profile: %ld samples (%.1f ms), %ld dropped\n",
+            vm->prof.samples, vm->prof.samples * ms, vm->prof.dropped);
+    fprintf(out, ";; %7s %10s %10s %10s  %s\n", "self%", "self-ms", "total-ms", "calls", "procedure");
+    for (int i = 0; i < count; i++) {
+        struct prof_proc* p = &vm->prof.procs[i];
+        fprintf(out, ";; %6.2f%% %10.1f %10.1f %10ld  %s\n", 100.0 * p->self / samples,
+                p->self * ms, p->total * ms, p->calls, p->name->s);
+    }
+    if (folded) {
+        FILE* fp = fopen(folded, "w");
+        if (!fp) { fprintf(out, ";; cannot write %s\n", folded); return; }
+        prof_write_folded(vm, fp);
+        fclose(fp);
+    }
+}
+
+// link a frame for the application of 'name' onto vm->frames. only the
+// profiler reads them, so nothing is linked unless it's sampling: a
+// profile started inside a procedure doesn't see the callers
+static inline void push_frame(struct sparrow_vm* vm, struct call_frame* f, struct object* name) {
+    struct sparrow_vm* root = vm->owner ? vm->owner : vm;
+    if (!root->prof.active) return;
+    f->name = name;
+    f->prev = vm->frames;
+    struct prof_proc* p = prof_proc(root, name);
+    if (p) __atomic_fetch_add(&p->calls, 1, __ATOMIC_RELAXED);
+    atomic_signal_fence(memory_order_release);  // frame is complete before it's visible
+    vm->frames = f;
+}
+
+// unlinks 'f' if push_frame did link it, even if sampling stopped since
+static inline void pop_frame(struct sparrow_vm* vm, struct call_frame* f) {
+    if (vm->frames == f) vm->frames = f->prev;
+}
+
+/*========================================================
+ * errors
+ * =======================================================*/
+/*
+ * raise_object longjmps to the innermost handler, which finds the raised
+ * object in vm->raised. a handler is pushed right before its setjmp:
+ *
+ *     struct handler h;
+ *     push_handler(vm, &h);
+ *     if (setjmp(h.jmp)) { ...vm->raised... }
+ *     ...
+ *     pop_handler(vm, &h);
+ *
+ * with no handler at all, the error is reported and the process aborts.
+ */
+static inline void push_handler(struct sparrow_vm* vm, struct handler* h) {
+    h->prev = vm->handlers;
+    h->frames = vm->frames;
+    vm->handlers = h;
+}
+
+static inline void pop_handler(struct sparrow_vm* vm, struct handler* h) {
+    vm->handlers = h->prev;
+}
+
+// "<message> <irritant> ...", or the raised object if it isn't an error
+static void fprint_error(FILE* out, struct object* o) {
+    if (o && o != g_dummy && o->type == ERROR) {
+        fprintf(out, "%s", o->message->s);
+        for (struct object* l = o->irritants; l; l = cdr(l)) {
+            fprintf(out, " ");
+            fprint(out, car(l));
+        }
+    } else {
+        fprint(out, o);
+    }
+}
+
+static void report_error(FILE* out, struct object* o) {
+    fprintf(out, "error: ");
+    fprint_error(out, o);
+    fprintf(out, "\n");
+}
+
+void raise_object(struct sparrow_vm* vm, struct object* o) {
+    struct handler* h = vm->handlers;
+    if (!h) {
+        fflush(vm->out);
+        report_error(stderr, o);
+        abort();
+    }
+    vm->raised = o;
+    vm->handlers = h->prev;
+    vm->frames = h->frames;
+    longjmp(h->jmp, 1);
+}
+
+void raise_error(struct sparrow_vm* vm, struct object* irritants, const char* fmt, ...) {
+    char message[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+    raise_object(vm, mk_error(vm, mk_str(vm, message), irritants));
+}
+
+// false if evaluating 'exp' raised an error, which is left in vm->raised
+static bool try_eval(struct sparrow_vm* vm, struct object* exp, struct object* env, struct object** val) {
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) return false;
+    *val = eval(vm, exp, env);
+    pop_handler(vm, &h);
+    return true;
+}
+
 /*========================================================
  * builtins: primitives and syntax
  * =======================================================*/
 // helpers
-struct object* _reverse(struct object* l, struct object* base) {
+struct object* _reverse(struct sparrow_vm* vm, struct object* l, struct object* base) {
     if (!l) return base;
-    return _reverse(cdr(l), cons(car(l), base));
+    return _reverse(vm, cdr(l), cons(vm, car(l), base));
 }
 
-struct object* reverse(struct object* l) {
-    return _reverse(l, NULL);
+struct object* reverse(struct sparrow_vm* vm, struct object* l) {
+    return _reverse(vm, l, NULL);
 }
 
-struct object* append(struct object* x, struct object* y) {
+struct object* append(struct sparrow_vm* vm, struct object* x, struct object* y) {
     if (!x) return y;  // both x and y are LIST
-    return cons(car(x), append(cdr(x), y));
+    return cons(vm, car(x), append(vm, cdr(x), y));
 }
 
-int len(struct object* l) {
+int len(struct sparrow_vm* vm, struct object* l) {
     if (!l) return 0;
     REQUIRE(l, LIST);
-    return 1 + len(cdr(l));
+    return 1 + len(vm, cdr(l));
 }
 
 bool is_equal(struct object *x, struct object *y) {
@@ -283,7 +826,7 @@ bool is_equal(struct object *x, struct object *y) {
      if (x->type != y->type) return false;
      switch (x->type) {
      case LIST:
-         return is_equal(car(x), car(y)) && is_equal(cdr(x), cdr(x));
+         return is_equal(car(x), car(y)) && is_equal(cdr(x), cdr(y));
      case NUMBER:
          return x->integer == y->integer;
      case STRING:
@@ -293,184 +836,429 @@ bool is_equal(struct object *x, struct object *y) {
      }
 }
 
-struct object* prim_cons(struct object* l) {
+struct object* prim_cons(struct sparrow_vm* vm, struct object* l) {
     // (cons x y)
     CHECK_ARITY(l, 2);
-    return cons(cadr(l), caddr(l));
+    return cons(vm, cadr(l), caddr(l));
 }
 
-struct object* prim_car(struct object* l) {
+struct object* prim_car(struct sparrow_vm* vm, struct object* l) {
     // (car l)
     CHECK_ARITY(l, 1); REQUIRE(cadr(l), LIST);
+    if (!cadr(l)) raise_error(vm, NULL, "car: empty list");
     return car(cadr(l));
 }
 
-struct object* prim_cdr(struct object* l) {
+struct object* prim_cdr(struct sparrow_vm* vm, struct object* l) {
     // (cdr l)
     CHECK_ARITY(l, 1); REQUIRE(cadr(l), LIST);
+    if (!cadr(l)) raise_error(vm, NULL, "cdr: empty list");
     return cdr(cadr(l));
 }
 
-struct object* prim_eq(struct object* exp) {
+struct object* prim_eq(struct sparrow_vm* vm, struct object* exp) {
     // (equal x y)
     CHECK_ARITY(exp, 2);
     exp = cdr(exp);
     struct object* x = car(exp);
     struct object* y = cadr(exp);
-    return is_equal(x, y) ? g_true : g_false;
+    return is_equal(x, y) ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_is_pair(struct object* exp) {
+struct object* prim_is_pair(struct sparrow_vm* vm, struct object* exp) {
     // (pair? exp)
     CHECK_ARITY(exp, 1);
     struct object* o = cadr(exp);
-    return o && o->type == LIST && cdr(o) != NULL ? g_true : g_false;
+    return o && o->type == LIST && cdr(o) != NULL ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_is_symbol(struct object* exp) {
+struct object* prim_is_symbol(struct sparrow_vm* vm, struct object* exp) {
     // (symbol? exp)
     CHECK_ARITY(exp, 1);
     struct object* o = cadr(exp);
-    return o && o->type == SYMBOL ? g_true : g_false;
+    return o && o->type == SYMBOL ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_is_string(struct object* exp) {
+struct object* prim_is_string(struct sparrow_vm* vm, struct object* exp) {
     // (string? exp)
     CHECK_ARITY(exp, 1);
     struct object* o = cadr(exp);
-    return o && o->type == STRING ? g_true : g_false;
+    return o && o->type == STRING ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_is_number(struct object* exp) {
+struct object* prim_is_number(struct sparrow_vm* vm, struct object* exp) {
     // (number? exp)
     CHECK_ARITY(exp, 1);
     struct object* o = cadr(exp);
-    return o && o->type == NUMBER ? g_true : g_false;
+    return o && o->type == NUMBER ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_isnull(struct object* exp) {
+struct object* prim_isnull(struct sparrow_vm* vm, struct object* exp) {
     // (null? l)
     CHECK_ARITY(exp, 1);
-    return cadr(exp) == NULL ? g_true : g_false;
+    return cadr(exp) == NULL ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_add(struct object* l) {
+struct object* prim_add(struct sparrow_vm* vm, struct object* l) {
     // (+ x ...)
-    l = cdr(l);
-    int64_t sum = car(l)->integer;
-    while ((l = cdr(l))) { sum += car(l)->integer; }
-    return mk_integer(sum);
+    int64_t sum = 0;
+    while ((l = cdr(l))) { REQUIRE(car(l), NUMBER); sum += car(l)->integer; }
+    return mk_integer(vm, sum);
 }
 
-struct object* prim_multiply(struct object* l) {
+struct object* prim_multiply(struct sparrow_vm* vm, struct object* l) {
     // (* x ...)
-    l = cdr(l);
-    int64_t product = car(l)->integer;
-    while ((l = cdr(l))) { product *= car(l)->integer; }
-    return mk_integer(product);
+    int64_t product = 1;
+    while ((l = cdr(l))) { REQUIRE(car(l), NUMBER); product *= car(l)->integer; }
+    return mk_integer(vm, product);
 }
 
-struct object* prim_subtract(struct object* l) {
+struct object* prim_subtract(struct sparrow_vm* vm, struct object* l) {
     // (- x ...)
     l = cdr(l);
+    if (!l) raise_error(vm, NULL, "bad arity: - needs at least 1 argument");
+    REQUIRE(car(l), NUMBER);
     int64_t sum = car(l)->integer;
-    while ((l = cdr(l))) { sum -= car(l)->integer; }
-    return mk_integer(sum);
+    while ((l = cdr(l))) { REQUIRE(car(l), NUMBER); sum -= car(l)->integer; }
+    return mk_integer(vm, sum);
 }
 
-struct object* prim_divide(struct object* exp) {
+struct object* prim_divide(struct sparrow_vm* vm, struct object* exp) {
     // (/ x y)
     CHECK_ARITY(exp, 2);
+    REQUIRE(cadr(exp), NUMBER); REQUIRE(caddr(exp), NUMBER);
+    if (!caddr(exp)->integer) raise_error(vm, NULL, "division by zero");
     int64_t quot = cadr(exp)->integer;
     quot /= caddr(exp)->integer;
-    return mk_integer(quot);
+    return mk_integer(vm, quot);
 }
 
-struct object* prim_mod(struct object* exp) {
+struct object* prim_mod(struct sparrow_vm* vm, struct object* exp) {
     // (mod x y)
     CHECK_ARITY(exp, 2);
+    REQUIRE(cadr(exp), NUMBER); REQUIRE(caddr(exp), NUMBER);
+    if (!caddr(exp)->integer) raise_error(vm, NULL, "division by zero");
     int64_t quot = cadr(exp)->integer;
     quot %= caddr(exp)->integer;
-    return mk_integer(quot);
+    return mk_integer(vm, quot);
 }
 
-struct object* prim_num_eq(struct object* exp) {
+struct object* prim_num_eq(struct sparrow_vm* vm, struct object* exp) {
     // (= x y)
     CHECK_ARITY(exp, 2);
     struct object* x = cadr(exp);
     struct object* y = caddr(exp);
     REQUIRE(x, NUMBER); REQUIRE(y, NUMBER);
-    return x->integer == y->integer ? g_true : g_false;
+    return x->integer == y->integer ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_num_lt(struct object* exp) {
+struct object* prim_num_lt(struct sparrow_vm* vm, struct object* exp) {
     // (< x y)
+    CHECK_ARITY(exp, 2);
     struct object* x = cadr(exp);
     struct object* y = caddr(exp);
     REQUIRE(x, NUMBER); REQUIRE(y, NUMBER);
-    return x->integer < y->integer ? g_true : g_false;
+    return x->integer < y->integer ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_not(struct object* exp) {
+struct object* prim_not(struct sparrow_vm* vm, struct object* exp) {
     // (not x)
-    return cadr(exp) == g_false ? g_true : g_false;
+    CHECK_ARITY(exp, 1);
+    return cadr(exp) == vm->false_obj ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_display(struct object* exp) {
+struct object* prim_display(struct sparrow_vm* vm, struct object* exp) {
     // (display x)
     CHECK_ARITY(exp, 1);
-    if (cadr(exp)->type == SYMBOL || cadr(exp)->type == STRING) {
-        printf("%s", cadr(exp)->s);
+    if (cadr(exp) && (cadr(exp)->type == SYMBOL || cadr(exp)->type == STRING)) {
+        fprintf(vm->out, "%s", cadr(exp)->s);
     } else {
-        print(cadr(exp));
+        fprint(vm->out, cadr(exp));
     }
-    printf("\n");
+    fprintf(vm->out, "\n");
     return g_dummy;
 }
-struct object* prim_newline(struct object* exp) {
-    printf("\n");
+struct object* prim_newline(struct sparrow_vm* vm, struct object* exp) {
+    fprintf(vm->out, "\n");
     return g_dummy;
 }
 
-struct object* prim_eval(struct object* exp) {
+struct object* prim_eval(struct sparrow_vm* vm, struct object* exp) {
     // (eval exp)
-    return eval(cadr(exp), the_global_environment);
+    CHECK_ARITY(exp, 1);
+    return eval(vm, cadr(exp), (vm->owner ? vm->owner : vm)->top_env);
 }
 
-struct object* prim_error(struct object* exp) {
-    // (error msg exp)
-    CHECK_ARITY(exp, 2);
+struct object* prim_error(struct sparrow_vm* vm, struct object* exp) {
+    // (error msg x y ...)
+    if (!cdr(exp)) raise_error(vm, NULL, "bad arity: error needs at least 1 argument");
     struct object* msg = cadr(exp);
     REQUIRE(msg, STRING);
-    exp = caddr(exp);
-    printf("%s%s ", "\x1B[31m", msg->s);
-    print(exp);
-    printf("%s\n", "\x1B[0m");
-    abort();
+    raise_object(vm, mk_error(vm, msg, cddr(exp)));
+}
+
+struct object* prim_raise(struct sparrow_vm* vm, struct object* exp) {
+    // (raise x)
+    CHECK_ARITY(exp, 1);
+    raise_object(vm, cadr(exp));
+}
+
+struct object* prim_with_exception_handler(struct sparrow_vm* vm, struct object* exp) {
+    // (with-exception-handler handler thunk)
+    CHECK_ARITY(exp, 2);
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) return apply(vm, cadr(exp), cons(vm, vm->raised, NULL));
+    struct object* val = apply(vm, caddr(exp), NULL);
+    pop_handler(vm, &h);
+    return val;
+}
+
+struct object* prim_is_error_object(struct sparrow_vm* vm, struct object* exp) {
+    // (error-object? x)
+    CHECK_ARITY(exp, 1);
+    struct object* o = cadr(exp);
+    return o && o != g_dummy && o->type == ERROR ? vm->true_obj : vm->false_obj;
+}
+
+struct object* prim_error_object_message(struct sparrow_vm* vm, struct object* exp) {
+    // (error-object-message e)
+    CHECK_ARITY(exp, 1);
+    REQUIRE(cadr(exp), ERROR);
+    return cadr(exp)->message;
+}
+
+struct object* prim_error_object_irritants(struct sparrow_vm* vm, struct object* exp) {
+    // (error-object-irritants e)
+    CHECK_ARITY(exp, 1);
+    REQUIRE(cadr(exp), ERROR);
+    return cadr(exp)->irritants;
+}
+
+// whether a task of 'vm' but the current one can run: one that is ready
+// and not itself waiting for a promise
+static bool sched_can_progress(struct sparrow_vm* vm) {
+    for (struct task* t = vm->sched.ready; t; t = t->next)
+        if (!t->awaiting) return true;
+    return false;
+}
+
+// the value of promise 'p', evaluated by the first force only. forcing it
+// again from its own expression evaluates it again and keeps the first value.
+// other threads wait for the one forcing it on promise_forced of the root
+// vm; tasks of our own thread can't be waited for that way, we let them
+// run, and take over from one that was discarded
+struct object* force(struct sparrow_vm* vm, struct object* p) {
+    if (__atomic_load_n(&p->forced, __ATOMIC_ACQUIRE)) return p->delayed;
+    struct sparrow_vm* root = vm->owner ? vm->owner : vm;
+    struct task* self = vm->sched.current ? vm->sched.current : &vm->sched.main;
+    self->vm = vm;
+    pthread_mutex_lock(&root->promise_lock);
+    while (!p->forced && p->forcer && p->forcer != self) {
+        struct task* t = p->forcer;
+        if (t->vm != vm) {
+            pthread_cond_wait(&root->promise_forced, &root->promise_lock);
+        } else if (t->done) {
+            p->forcer = NULL;
+        } else if (sched_can_progress(vm)) {
+            pthread_mutex_unlock(&root->promise_lock);
+            self->awaiting = p;
+            task_yield(vm);
+            self->awaiting = NULL;
+            pthread_mutex_lock(&root->promise_lock);
+        } else {
+            pthread_mutex_unlock(&root->promise_lock);
+            raise_error(vm, NULL, "deadlock: the task forcing the promise can't run");
+        }
+    }
+    if (p->forced) {
+        pthread_mutex_unlock(&root->promise_lock);
+        return p->delayed;
+    }
+    bool first = !p->forcer;
+    p->forcer = self;
+    struct object* exp = p->delayed;
+    struct object* env = p->delayed_env;
+    pthread_mutex_unlock(&root->promise_lock);
+
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) {  // unforced again, the next force retries
+        if (first) {
+            pthread_mutex_lock(&root->promise_lock);
+            p->forcer = NULL;
+            pthread_cond_broadcast(&root->promise_forced);
+            pthread_mutex_unlock(&root->promise_lock);
+        }
+        raise_object(vm, vm->raised);
+    }
+    struct object* val = eval(vm, exp, env);
+    pop_handler(vm, &h);
+    pthread_mutex_lock(&root->promise_lock);
+    if (!p->forced) {  // unless forcing it forced it already
+        p->delayed = val;
+        p->delayed_env = NULL;
+        p->forcer = NULL;
+        __atomic_store_n(&p->forced, true, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&root->promise_forced);
+    }
+    pthread_mutex_unlock(&root->promise_lock);
+    return p->delayed;
+}
+
+struct object* prim_force(struct sparrow_vm* vm, struct object* exp) {
+    // (force promise)  ;; anything else is its own value
+    CHECK_ARITY(exp, 1);
+    struct object* o = cadr(exp);
+    return o && o != g_dummy && o->type == PROMISE ? force(vm, o) : o;
+}
+
+struct object* prim_is_promise(struct sparrow_vm* vm, struct object* exp) {
+    // (promise? x)
+    CHECK_ARITY(exp, 1);
+    struct object* o = cadr(exp);
+    return o && o != g_dummy && o->type == PROMISE ? vm->true_obj : vm->false_obj;
+}
+
+struct object* prim_read(struct sparrow_vm* vm, struct object* exp) {
+    // (read) or (read port)
+    struct object* port = cdr(exp) ? cadr(exp) : NULL;
+    if (!port) return read_exp(vm, stdin);
+    REQUIRE(port, PORT);
+    if (!port->stream) raise_error(vm, NULL, "read: port is closed");
+    struct object* o = read_exp(vm, port->stream);
+    return o == g_dummy ? vm->eof_obj : o;
+}
+
+struct object* prim_open_input_file(struct sparrow_vm* vm, struct object* exp) {
+    // (open-input-file filename)
+    CHECK_ARITY(exp, 1);
+    struct object* filename = cadr(exp);
+    REQUIRE(filename, STRING);
+    FILE* fp = fopen(filename->s, "r");
+    if (!fp) raise_error(vm, list(vm, 1, filename), "open-input-file: %s", strerror(errno));
+    return mk_port(vm, fp);
+}
+
+struct object* prim_close_port(struct sparrow_vm* vm, struct object* exp) {
+    // (close-port port)
+    CHECK_ARITY(exp, 1);
+    struct object* port = cadr(exp);
+    REQUIRE(port, PORT);
+    if (port->stream) fclose(port->stream);
+    port->stream = NULL;
     return g_dummy;
 }
-struct object* prim_read(struct object* exp) {
-    return read_exp(stdin);
+
+struct object* prim_is_eof_object(struct sparrow_vm* vm, struct object* exp) {
+    // (eof-object? x)  ;; what read returns at the end of a port
+    CHECK_ARITY(exp, 1);
+    return cadr(exp) == vm->eof_obj ? vm->true_obj : vm->false_obj;
 }
 
-struct object* prim_environ(struct object* exp) {
+struct object* prim_environ(struct sparrow_vm* vm, struct object* exp) {
     // (environ)
-    PRINT(the_global_environment);
+    fprintf(vm->out, "\n");
+    fprint(vm->out, vm->global_env);
+    fprintf(vm->out, "\n");
     return g_dummy;
 }
 
-struct object* prim_length(struct object* l) {return mk_integer(len(l));}
+struct object* prim_length(struct sparrow_vm* vm, struct object* exp) {
+    // (length l)
+    CHECK_ARITY(exp, 1);
+    return mk_integer(vm, len(vm, cadr(exp)));
+}
 
-struct object* load(struct object* module) {
-    REQUIRE(module, STRING);
-    const char* filename = module->s;
-    FILE* fp = fopen(filename, "r");
-    if (!fp) {printf("load failed!\n"); return NULL;}
+// ((objects . n) (bytes . n) ... (<type> <objects> <bytes>) ...)
+struct object* heap_stats(struct sparrow_vm* vm) {
+    long objects = 0, bytes = 0;
+    struct object* types = NULL;
+    for (int t = N_TYPES - 1; t >= 0; t--) {
+        objects += vm->heap.objects[t];
+        bytes += vm->heap.bytes[t];
+        types = cons(vm, list(vm, 3, mk_sym(vm, types_str[t]), mk_integer(vm, vm->heap.objects[t]),
+                          mk_integer(vm, vm->heap.bytes[t])), types);
+    }
+    struct object* totals = list(vm, 5,
+            cons(vm, mk_sym(vm, "objects"), mk_integer(vm, objects)),
+            cons(vm, mk_sym(vm, "bytes"), mk_integer(vm, bytes)),
+            cons(vm, mk_sym(vm, "environments"), mk_integer(vm, vm->heap.objects[ENVIRONMENT])),
+            cons(vm, mk_sym(vm, "arg-lists"), mk_integer(vm, vm->heap.arg_lists)),
+            cons(vm, mk_sym(vm, "arg-conses"), mk_integer(vm, vm->heap.arg_conses)));
+    return append(vm, totals, types);
+}
+
+static long heap_total(long* counters) {
+    long sum = 0;
+    for (int t = 0; t < N_TYPES; t++) sum += counters[t];
+    return sum;
+}
+
+void print_heap_stats(struct sparrow_vm* vm, FILE* out) {
+    long objects = heap_total(vm->heap.objects), bytes = heap_total(vm->heap.bytes);
+    fprintf(out, ";; heap: %ld objects, %ld bytes, %ld environments, %ld argument lists (%ld conses)\n",
+            objects, bytes, vm->heap.objects[ENVIRONMENT], vm->heap.arg_lists, vm->heap.arg_conses);
+    fprintf(out, ";; %-12s %10s %12s\n", "type", "objects", "bytes");
+    for (int t = 0; t < N_TYPES; t++) {
+        if (vm->heap.objects[t]) fprintf(out, ";; %-12s %10ld %12ld\n", types_str[t], vm->heap.objects[t], vm->heap.bytes[t]);
+    }
+}
+
+static int64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct object* prim_runtime(struct sparrow_vm* vm, struct object* exp) {
+    // (runtime) ;; cpu time in microseconds
+    CHECK_ARITY(exp, 0);
+    return mk_integer(vm, now_ns(CLOCK_PROCESS_CPUTIME_ID) / 1000);
+}
+
+struct object* prim_current_time_ns(struct sparrow_vm* vm, struct object* exp) {
+    // (current-time-ns) ;; monotonic wall clock
+    CHECK_ARITY(exp, 0);
+    return mk_integer(vm, now_ns(CLOCK_MONOTONIC));
+}
+
+struct object* prim_heap_stats(struct sparrow_vm* vm, struct object* exp) {
+    // (heap-stats)
+    CHECK_ARITY(exp, 0);
+    return heap_stats(vm);
+}
+
+struct object* prim_profile_start(struct sparrow_vm* vm, struct object* exp) {
+    // (profile-start)
+    CHECK_ARITY(exp, 0);
+    prof_start(vm);
+    return g_dummy;
+}
+
+struct object* prim_profile_stop(struct sparrow_vm* vm, struct object* exp) {
+    // (profile-stop) or (profile-stop "stacks.folded")
+    struct object* folded = cdr(exp) ? cadr(exp) : NULL;
+    if (folded) REQUIRE(folded, STRING);
+    prof_stop(vm, vm->out, folded ? folded->s : NULL);
+    return g_dummy;
+}
+
+// evaluate every expression read from 'fp' in 'env'. with 'errors', an
+// error only abandons the expression that raised it: it is reported on
+// stderr and counted, instead of being raised to the caller
+struct object* load_stream(struct sparrow_vm* vm, FILE* fp, struct object* env, int* errors) {
     struct object* val = NULL;
     while (true) {
-        struct object* exp = read_exp(fp);
+        struct object* exp = read_exp(vm, fp);
         if (exp == g_dummy) break;
-        val = eval(exp, the_global_environment);
+        if (!errors) {
+            val = eval(vm, exp, env);
+        } else if (!try_eval(vm, exp, env, &val)) {
+            fflush(vm->out);
+            report_error(stderr, vm->raised);
+            (*errors)++;
+        }
 #if defined(DEBUG)
         printf("************************\n");
         print(exp);
@@ -479,97 +1267,260 @@ struct object* load(struct object* module) {
         printf("\n************************\n\n");
 #endif
     }
+    return val;
+}
+
+struct object* load(struct sparrow_vm* vm, struct object* module) {
+    REQUIRE(module, STRING);
+    const char* filename = module->s;
+    FILE* fp = fopen(filename, "r");
+    if (!fp) raise_error(vm, list(vm, 1, module), "load: %s", strerror(errno));
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) {
+        fclose(fp);
+        raise_object(vm, vm->raised);
+    }
+    struct object* val = load_stream(vm, fp, (vm->owner ? vm->owner : vm)->top_env, NULL);
+    pop_handler(vm, &h);
     fclose(fp);
     return val;
 }
 
-struct object* prim_apply(struct object* exp) {
+struct object* prim_parallel_map(struct sparrow_vm* vm, struct object* exp) {
+    // (parallel-map func l)
+    CHECK_ARITY(exp, 2);
+    REQUIRE(caddr(exp), LIST);
+    return parallel_map(vm, cadr(exp), caddr(exp));
+}
+
+struct object* prim_parallel_for_each(struct sparrow_vm* vm, struct object* exp) {
+    // (parallel-for-each func l)
+    CHECK_ARITY(exp, 2);
+    REQUIRE(caddr(exp), LIST);
+    parallel_map(vm, cadr(exp), caddr(exp));
+    return g_dummy;
+}
+
+// tasks live in the vm that spawned them, workers can't reach it
+static void require_task_vm(struct sparrow_vm* vm, struct object* exp) {
+    if (vm->owner) raise_error(vm, NULL, "%s can't be used inside parallel-map", car(exp)->prim_name->s);
+}
+
+struct object* prim_spawn(struct sparrow_vm* vm, struct object* exp) {
+    // (spawn func x y ...)  ;; runs (func x y ...) as a new task
+    require_task_vm(vm, exp);
+    return spawn(vm, cadr(exp), cddr(exp));
+}
+
+struct object* prim_yield(struct sparrow_vm* vm, struct object* exp) {
+    // (yield)
+    CHECK_ARITY(exp, 0);
+    require_task_vm(vm, exp);
+    task_yield(vm);
+    return g_dummy;
+}
+
+struct object* prim_make_channel(struct sparrow_vm* vm, struct object* exp) {
+    // (make-channel)
+    CHECK_ARITY(exp, 0);
+    return mk_channel(vm);
+}
+
+struct object* prim_send(struct sparrow_vm* vm, struct object* exp) {
+    // (send channel x)
+    CHECK_ARITY(exp, 2);
+    require_task_vm(vm, exp);
+    REQUIRE(cadr(exp), CHANNEL);
+    channel_send(vm, cadr(exp)->channel, caddr(exp));
+    return g_dummy;
+}
+
+struct object* prim_receive(struct sparrow_vm* vm, struct object* exp) {
+    // (receive channel)  ;; parks the task until something is sent
+    CHECK_ARITY(exp, 1);
+    require_task_vm(vm, exp);
+    REQUIRE(cadr(exp), CHANNEL);
+    return channel_receive(vm, cadr(exp)->channel);
+}
+
+struct object* prim_memoize(struct sparrow_vm* vm, struct object* exp) {
+    // (memoize func) or (memoize func capacity)
+    struct object* func = cadr(exp);
+    int capacity = MEMO_CAPACITY;
+    if (cddr(exp)) {
+        REQUIRE(caddr(exp), NUMBER);
+        if (caddr(exp)->integer <= 0) raise_error(vm, cddr(exp), "memoize: capacity must be positive");
+        capacity = caddr(exp)->integer;
+    }
+    if (!func || func == g_dummy || (func->type != PROCEDURE && func->type != PRIMITIVE && func->type != MEMOIZED)) {
+        raise_error(vm, list(vm, 1, func), "not applicable");
+    }
+    return mk_memoized(vm, func, capacity);
+}
+
+struct object* prim_memo_stats(struct sparrow_vm* vm, struct object* exp) {
+    // (memo-stats func)  ;; ((hits . n) (misses . n) (size . n) (capacity . n))
+    CHECK_ARITY(exp, 1);
+    REQUIRE(cadr(exp), MEMOIZED);
+    return memo_stats(vm, cadr(exp)->memo);
+}
+
+struct object* prim_memo_clear(struct sparrow_vm* vm, struct object* exp) {
+    // (memo-clear! func)  ;; forgets the results and zeroes the counters
+    CHECK_ARITY(exp, 1);
+    REQUIRE(cadr(exp), MEMOIZED);
+    memo_clear(cadr(exp)->memo);
+    return g_dummy;
+}
+
+struct object* gensym(struct sparrow_vm* vm, const char* base) {
+    struct sparrow_vm* root = vm->owner ? vm->owner : vm;
+    char name[128];
+    snprintf(name, sizeof(name), "%.100s;%ld", base, __atomic_add_fetch(&root->gensyms, 1, __ATOMIC_RELAXED));
+    return mk_sym(vm, name);  // ';' starts a comment, so no symbol that is read clashes
+}
+
+struct object* prim_gensym(struct sparrow_vm* vm, struct object* exp) {
+    // (gensym)
+    CHECK_ARITY(exp, 0);
+    return gensym(vm, "g");
+}
+
+struct object* prim_macroexpand(struct sparrow_vm* vm, struct object* exp) {
+    // (macroexpand '(<macro> ...))  ;; until it's no macro use
+    CHECK_ARITY(exp, 1);
+    struct object* form = cadr(exp);
+    while (form && form->type == LIST && car(form) && car(form)->type == SYMBOL) {
+        struct object* m = lookup_variable(car(form), vm->global_env);
+        if (!m || m == g_dummy || m->type != MACRO) break;
+        form = expansion(vm, m, form);
+    }
+    return form;
+}
+
+struct object* prim_load(struct sparrow_vm* vm, struct object* exp) {
+    // (load "file.scm")
+    CHECK_ARITY(exp, 1);
+    return load(vm, cadr(exp));
+}
+
+struct object* prim_apply(struct sparrow_vm* vm, struct object* exp) {
     // (apply func x y ... l)  ;; l must be LIST
+    if (len(vm, cdr(exp)) < 2) raise_error(vm, NULL, "bad arity: apply needs at least 2 arguments");
     struct object* func = cadr(exp);
     struct object* args = cddr(exp);
     struct object* l = NULL;
-    do {
-        struct object* arg = car(args);
-        if (arg->type == LIST && cdr(args) == NULL) {
-            // last arg must be LIST
-            args = arg;
-            break;
-        }
-        l = cons(arg, l);
+    while (cdr(args)) {
+        l = cons(vm, car(args), l);
         args = cdr(args);
-    } while (true);
-    l = reverse(l);
-    args = append(l, args);
-    switch(func->type) {
-        case PRIMITIVE: return (func->primitive)(cons(func, args));
-        case PROCEDURE: 
-        {
-            struct object* params = func->params;
-            struct object* new_env = mk_env(func->env);
-            while (params && args) {
-                struct object* param = car(params);
-                define_variable(param, args, new_env);
-                params = cdr(params);
-                args = cdr(args);
-            }
-            struct object* body = func->body;
-            return eval(body, new_env);
-        }
-        default: return NULL;
     }
+    args = car(args);  // last arg must be LIST
+    REQUIRE(args, LIST);
+    return apply(vm, func, append(vm, reverse(vm, l), args));
 }
 
-struct object* syntax_if(struct object* exp, struct object* env) {
+struct object* syntax_if(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     // (if predicate consequent alternative)
     struct object* predicate = cadr(exp);
-    struct object* ret = eval(predicate, env);
-    if (ret == g_false){
+    struct object* ret = eval(vm, predicate, env);
+    if (ret == vm->false_obj){
+        if (!cdr(cddr(exp))) return NULL;  // no alternative
         struct object* alternative = cadr(cddr(exp));
-        return eval(alternative, env);
+        return eval(vm, alternative, env);
     } else {
         struct object* consequent = caddr(exp);
-        return eval(consequent, env);
+        return eval(vm, consequent, env);
     }
 }
 
-struct object* syntax_quote(struct object* exp, struct object* env) {
+struct object* syntax_quote(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     // (quote <datum>)
     return cadr(exp);
 }
 
-struct object* syntax_define(struct object* exp, struct object* env) {
+struct object* syntax_define(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     if (cadr(exp)->type == LIST) {
         // (define (<var> <param1> <param2> ...) <body>)
         struct object* var = car(cadr(exp));  // (var ...)
         struct object* params = cdr(cadr(exp));
         struct object* body = cddr(exp);
-        if (len(body) == 1)
+        if (len(vm, body) == 1)
         {
             body = caddr(exp);
-            return define_variable(var, mk_procedure(var->s, params, body, env), env);
         } else {  // block structure and internal definition
              // (define (<var> ...) <exp1>  ... <expn>)
-            body = cons(mk_sym("begin"), body);
-            struct object* o = define_variable(var, mk_procedure(var->s, params, body, env), env);
-            return o;
+            body = cons(vm, vm->sym.begin, body);
         }
+        mark_source(body);
+        struct object* proc = mk_procedure(vm, var, params, body, env);
+        optimize(vm, proc);
+        return define_variable(vm, var, proc, env);
     } else { // (define <var> <val>)
-        return define_variable(cadr(exp), eval(caddr(exp), env), env);
+        return define_variable(vm, cadr(exp), eval(vm, caddr(exp), env), env);
     }
 }
 
-struct object* syntax_lambda(struct object* exp, struct object* env) {
-    // (lambda (<params>) <body>)
-    struct object* params = cadr(exp);
-    struct object* body = caddr(exp);
-    if (params->type != LIST && params->type == SYMBOL) {  // variadic
-        params = cons(mk_sym("."), cons(params, NULL));
+struct object* syntax_define_memoized(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (define-memoized (<var> <params>) [#:capacity n] <body>), recursive calls hit the cache too
+    if (!cadr(exp) || cadr(exp)->type != LIST) raise_error(vm, cdr(exp), "define-memoized: needs (<var> <params>)");
+    struct object* var = car(cadr(exp));
+    int capacity = MEMO_CAPACITY;
+    if (cddr(exp) && caddr(exp) == vm->sym.capacity) {
+        if (!cdr(cddr(exp)) || !cddr(cddr(exp))) raise_error(vm, cdr(exp), "define-memoized: needs #:capacity n <body>");
+        struct object* n = eval(vm, cadr(cddr(exp)), env);
+        REQUIRE(n, NUMBER);
+        if (n->integer <= 0) raise_error(vm, list(vm, 1, n), "define-memoized: capacity must be positive");
+        capacity = n->integer;
+        exp = cons(vm, car(exp), cons(vm, cadr(exp), cddr(cddr(exp))));
     }
-    struct object* closure = mk_procedure("lambda", params, body, env);
-    return closure;
+    syntax_define(vm, exp, env);
+    return define_variable(vm, var, mk_memoized(vm, lookup_variable(var, env), capacity), env);
 }
 
-struct object* syntax_cond(struct object* exp, struct object* env) {
+struct object* mk_macro(struct sparrow_vm* vm, struct object* expander, struct object* literals, struct object* rules) {
+    struct object* o = mk_obj(vm, MACRO);
+    o->expander = expander;
+    o->literals = literals;
+    o->rules = rules;
+    return o;
+}
+
+struct object* syntax_define_macro(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (define-macro (<name> <params>) <body>), <body> makes the expansion of the unevaluated arguments
+    if (!cadr(exp) || cadr(exp)->type != LIST) raise_error(vm, cdr(exp), "define-macro: needs (<name> <params>)");
+    struct object* name = car(cadr(exp));
+    struct object* body = cdr(cddr(exp)) ? cons(vm, vm->sym.begin, cddr(exp)) : caddr(exp);
+    struct object* expander = mk_procedure(vm, name, cdr(cadr(exp)), body, env);
+    return define_variable(vm, name, mk_macro(vm, expander, NULL, NULL), env);
+}
+
+struct object* syntax_define_syntax(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (define-syntax <name> (syntax-rules ...))
+    struct object* macro = eval(vm, caddr(exp), env);
+    REQUIRE(macro, MACRO);
+    return define_variable(vm, cadr(exp), macro, env);
+}
+
+struct object* syntax_syntax_rules(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (syntax-rules (<literal> ...) (<pattern> <template>) ...)
+    return mk_macro(vm, NULL, cadr(exp), cddr(exp));
+}
+
+struct object* syntax_lambda(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (lambda (<params>) <body>)
+    struct object* params = cadr(exp);
+    struct object* body = caddr(exp);
+    if (params && params->type == SYMBOL) {  // variadic
+        params = cons(vm, vm->sym.dot, cons(vm, params, NULL));
+    }
+    mark_source(body);
+    struct object* closure = mk_procedure(vm, vm->sym.lambda, params, body, env);
+    optimize(vm, closure);
+    return closure;
+}
+
+struct object* syntax_cond(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     /*
      * (cond (<p1> <e1>)
      *       ...
@@ -579,83 +1530,353 @@ struct object* syntax_cond(struct object* exp, struct object* env) {
     while (clauses) {
         struct object* clause = car(clauses);
         struct object* predicate = car(clause);
-        struct object* test = eval(predicate, env);
-        if (test == g_false) {
+        struct object* test = eval(vm, predicate, env);
+        if (test == vm->false_obj) {
             clauses = cdr(clauses);
         } else {
-            return eval(cadr(clause), env); 
+            return eval(vm, cadr(clause), env); 
         }
     }
     return NULL;
 }
 
-struct object* syntax_begin(struct object* exp, struct object* env) {
+struct object* syntax_begin(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     /*
      * (begin <e1> <e2> ... <en>)
      */
     struct object* actions = cdr(exp);
     struct object* ret = NULL;
     while (actions) {
-        ret = eval(car(actions), env);
+        ret = eval(vm, car(actions), env);
         actions = cdr(actions);
     }
     return ret;
 }
 
-struct object* syntax_let(struct object* let_exp, struct object* env) {
+// the variables and the values in 'env' of '((<var> <exp>) ...)', in order
+static void eval_bindings(struct sparrow_vm* vm, struct object* bindings, struct object* env,
+                          struct object** vars, struct object** vals) {
+    struct object *var_tail = NULL, *val_tail = NULL;
+    *vars = *vals = NULL;
+    for (; bindings; bindings = cdr(bindings)) {
+        struct object* binding = car(bindings);
+        struct object* var = cons(vm, car(binding), NULL);
+        struct object* val = cons(vm, eval(vm, cadr(binding), env), NULL);
+        if (var_tail) {
+            var_tail->cdr = var;
+            val_tail->cdr = val;
+        } else {
+            *vars = var;
+            *vals = val;
+        }
+        var_tail = var;
+        val_tail = val;
+    }
+}
+
+// a frame binding the lists 'vars' to 'vals' on top of 'parent'
+static struct object* extend_env(struct sparrow_vm* vm, struct object* parent, struct object* vars, struct object* vals) {
+    struct object* env = mk_env(vm, parent);
+    env->frame->car = vars;
+    env->frame->cdr = vals;
+    return env;
+}
+
+static struct object* let_env(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    struct object *vars, *vals;
+    eval_bindings(vm, cadr(exp), env, &vars, &vals);
+    return extend_env(vm, env, vars, vals);
+}
+
+static struct object* let_star_env(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    struct object* new_env = mk_env(vm, env);
+    for (struct object* l = cadr(exp); l; l = cdr(l)) {
+        define_variable(vm, car(car(l)), eval(vm, cadr(car(l)), new_env), new_env);
+    }
+    return new_env;
+}
+
+static struct object* letrec_env(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    struct object* new_env = mk_env(vm, env);
+    struct object* l;
+    for (l = cadr(exp); l; l = cdr(l)) define_variable(vm, car(car(l)), NULL, new_env);
+    for (l = cadr(exp); l; l = cdr(l)) define_variable(vm, car(car(l)), eval(vm, cadr(car(l)), new_env), new_env);
+    return new_env;
+}
+
+// the value for 'key' in 't', NULL if there is none yet
+static struct object** table_slot(struct table* t, struct object* key) {
+    if (4 * (t->count + 1) > 3 * t->size) {  // grow and rehash
+        struct object** keys = t->keys;
+        struct object** values = t->values;
+        int size = t->size;
+        t->size = size ? 2 * size : 256;
+        t->keys = calloc(t->size, sizeof(struct object*));
+        t->values = calloc(t->size, sizeof(struct object*));
+        t->count = 0;
+        for (int i = 0; i < size; i++) {
+            if (keys[i]) *table_slot(t, keys[i]) = values[i];
+        }
+        free(keys);
+        free(values);
+    }
+    unsigned long mask = t->size - 1;
+    for (unsigned long i = prof_hash(key, 0) & mask; ; i = (i + 1) & mask) {
+        if (t->keys[i] == key) return &t->values[i];
+        if (!t->keys[i]) {
+            t->keys[i] = key;
+            t->count++;
+            return &t->values[i];
+        }
+    }
+}
+
+// like table_slot, but NULL if 'key' isn't in 't'
+static struct object** table_find(struct table* t, struct object* key) {
+    if (!t->count) return NULL;
+    unsigned long mask = t->size - 1;
+    for (unsigned long i = prof_hash(key, 0) & mask; t->keys[i]; i = (i + 1) & mask) {
+        if (t->keys[i] == key) return &t->values[i];
+    }
+    return NULL;
+}
+
+// may evaluating 'exp' make a closure, which could capture the current frame?
+static bool may_capture(struct sparrow_vm* vm, struct object* exp) {
+    if (!exp || exp == g_dummy || exp->type != LIST) return false;
+    struct object* op = car(exp);
+    if (op == vm->sym.quote) return false;
+    if (op == vm->sym.lambda || op == vm->sym.delay || op == vm->sym.cons_stream) return true;
+    if ((op == vm->sym.define || op == vm->sym.define_memoized) && cdr(exp) && cadr(exp) && cadr(exp)->type == LIST) {
+        return true;
+    }
+    if (op == vm->sym.let && cdr(exp) && cadr(exp) && cadr(exp)->type == SYMBOL) return true;  // named
+    struct object* f = op && op->type == SYMBOL ? lookup_variable(op, vm->global_env) : g_dummy;
+    if (f && f != g_dummy && f->type == MACRO) return true;  // who knows what it expands to
+    for (; exp && exp->type == LIST; exp = cdr(exp)) {
+        if (may_capture(vm, car(exp))) return true;
+    }
+    return false;
+}
+
+// can the loop 'form' rebind its variables in place, as nothing captures them?
+static bool loop_in_place(struct sparrow_vm* vm, struct object* form) {
+    if (!form->source) return !may_capture(vm, cdr(form));  // built at run time, maybe once
+    struct object** slot = table_slot(&vm->forms, form);
+    if (!*slot) *slot = may_capture(vm, cdr(form)) ? vm->false_obj : vm->true_obj;
+    return *slot == vm->true_obj;
+}
+
+struct object* syntax_let(struct sparrow_vm* vm, struct object* exp, struct object* env);
+struct object* syntax_let_star(struct sparrow_vm* vm, struct object* exp, struct object* env);
+struct object* syntax_letrec(struct sparrow_vm* vm, struct object* exp, struct object* env);
+
+/*
+ * the value of 'exp' in 'env', but a call to the loop 'proc' in tail
+ * position, through if, cond, begin and the lets, only evaluates its 'n'
+ * arguments into 'args' and returns g_loop
+ */
+static struct object* eval_tail(struct sparrow_vm* vm, struct object* exp, struct object* env,
+                                struct object* proc, struct object** args, int n) {
+    while (exp && exp != g_dummy && exp->type == LIST && car(exp) && car(exp)->type == SYMBOL) {
+        struct object* op = lookup_variable(car(exp), env);
+        if (op == proc) {
+            int i = 0;
+            struct object* l = cdr(exp);
+            for (; l && i < n; l = cdr(l)) args[i++] = eval(vm, car(l), env);
+            if (l || i < n) raise_error(vm, NULL, "bad arity: %s needs %d arguments", proc->name->s, n);
+            return g_loop;
+        }
+        if (op && op != g_dummy && op->type == MACRO) {
+            exp = expansion(vm, op, exp);
+            continue;
+        }
+        if (op == g_dummy || op->type != SYNTAX) break;
+        struct object* body;
+        if (op->syntax == syntax_if) {
+            bool test = eval(vm, cadr(exp), env) != vm->false_obj;
+            if (!test && !cdr(cddr(exp))) return NULL;  // no alternative
+            exp = test ? caddr(exp) : cadr(cddr(exp));
+            continue;
+        } else if (op->syntax == syntax_cond) {
+            struct object* clauses = cdr(exp);
+            while (clauses && eval(vm, car(car(clauses)), env) == vm->false_obj) clauses = cdr(clauses);
+            if (!clauses) return NULL;
+            exp = cadr(car(clauses));
+            continue;
+        } else if (op->syntax == syntax_begin) {
+            body = cdr(exp);
+        } else if (op->syntax == syntax_let && !(cadr(exp) && cadr(exp)->type == SYMBOL)) {
+            env = let_env(vm, exp, env);
+            body = cddr(exp);
+        } else if (op->syntax == syntax_let_star) {
+            env = let_star_env(vm, exp, env);
+            body = cddr(exp);
+        } else if (op->syntax == syntax_letrec) {
+            env = letrec_env(vm, exp, env);
+            body = cddr(exp);
+        } else {
+            break;
+        }
+        if (!body) return NULL;
+        for (; cdr(body); body = cdr(body)) eval(vm, car(body), env);
+        exp = car(body);
+    }
+    return eval(vm, exp, env);
+}
+
+/*
+ * run the body of 'proc' in 'env', which binds its parameters. tail calls
+ * to itself go around again: in the same frame when 'in_place', else in a
+ * fresh one, so closures made by an iteration keep their own bindings.
+ * either way the C stack doesn't grow.
+ */
+static struct object* eval_loop(struct sparrow_vm* vm, struct object* proc, struct object* env, bool in_place) {
+    int n = len(vm, proc->params);
+    struct object* args[n + 1];
+    struct object* vals = cdr(env->frame);
+    struct call_frame frame;
+    push_frame(vm, &frame, proc->name);
+    struct object* val;
+    while ((val = eval_tail(vm, proc->body, env, proc, args, n)) == g_loop) {
+        if (in_place) {
+            struct object* l = vals;
+            for (int i = 0; i < n; i++, l = cdr(l)) l->car = args[i];
+        } else {
+            vals = NULL;
+            for (int i = n - 1; i >= 0; i--) vals = cons(vm, args[i], vals);
+            env = extend_env(vm, env->parent, proc->params, vals);
+        }
+    }
+    pop_frame(vm, &frame);
+    return val;
+}
+
+struct object* syntax_let(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     /*
      * (let ((<var1> <exp1>) ... (<varn> <expn>)) <body>)
-     * <=>
-     * ((lambda (<var1> ... <varn>) <body>) <exp1> ... <expn>)
+     * or, looping by calling <name> in tail position:
+     * (let <name> ((<var1> <exp1>) ... (<varn> <expn>)) <body>)
      */
-    struct object* pairs = cadr(let_exp);
-    struct object* vars = NULL;
-    struct object* exps = NULL;
-    while (pairs) {
-        struct object* pair = car(pairs);
-        vars = cons(car(pair), vars);
-        exps = cons(cadr(pair), exps);
-        pairs = cdr(pairs);
-    }
-    vars = reverse(vars);
-    exps = reverse(exps);
-    struct object* body = cddr(let_exp);
-    struct object* lambda = NULL;
-    if (len(body) != 1) {
-        body = cons(mk_sym("begin"), body);
-        lambda = cons(mk_sym("lambda"), list(2, vars, body));
-    } else {
-        lambda = cons(mk_sym("lambda"), cons(vars, body));
-    }
-    struct object* transformed = cons(lambda, exps);
-    return eval(transformed, env);
+    if (!(cadr(exp) && cadr(exp)->type == SYMBOL)) return syntax_begin(vm, cdr(exp), let_env(vm, exp, env));
+    struct object* name = cadr(exp);
+    struct object *vars, *vals;
+    eval_bindings(vm, caddr(exp), env, &vars, &vals);
+    struct object* body = cdddr(exp);
+    body = cdr(body) ? cons(vm, vm->sym.begin, body) : car(body);
+    struct object* proc_env = mk_env(vm, env);
+    struct object* proc = mk_procedure(vm, name, vars, body, proc_env);
+    define_variable(vm, name, proc, proc_env);
+    return eval_loop(vm, proc, extend_env(vm, proc_env, vars, vals), loop_in_place(vm, exp));
+}
+
+struct object* syntax_let_star(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (let* ((<var1> <exp1>) ... (<varn> <expn>)) <body>), <exp2> sees <var1>...
+    return syntax_begin(vm, cdr(exp), let_star_env(vm, exp, env));
 }
 
-struct object* syntax_set(struct object* exp, struct object* env) {
+struct object* syntax_letrec(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (letrec ((<var1> <exp1>) ... (<varn> <expn>)) <body>), every <exp> sees every <var>
+    return syntax_begin(vm, cdr(exp), letrec_env(vm, exp, env));
+}
+
+struct object* syntax_do(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    /*
+     * (do ((<var1> <init1> <step1>) ... (<varn> <initn> <stepn>))
+     *     (<test> <exp> ...)
+     *   <body>)
+     * a <var> without <step> keeps its value
+     */
+    struct object* specs = cadr(exp);
+    struct object* exit = caddr(exp);
+    struct object* body = cdddr(exp);
+    struct object *vars, *vals;
+    eval_bindings(vm, specs, env, &vars, &vals);
+    struct object* loop_env = extend_env(vm, env, vars, vals);
+    bool in_place = loop_in_place(vm, exp);
+    int n = len(vm, vars);
+    struct object* args[n + 1];
+    while (eval(vm, car(exit), loop_env) == vm->false_obj) {
+        for (struct object* l = body; l; l = cdr(l)) eval(vm, car(l), loop_env);
+        struct object* spec = specs;
+        struct object* val = vals;
+        for (int i = 0; i < n; i++, spec = cdr(spec), val = cdr(val)) {
+            args[i] = cddr(car(spec)) ? eval(vm, caddr(car(spec)), loop_env) : car(val);
+        }
+        if (in_place) {
+            val = vals;
+            for (int i = 0; i < n; i++, val = cdr(val)) val->car = args[i];
+        } else {
+            vals = NULL;
+            for (int i = n - 1; i >= 0; i--) vals = cons(vm, args[i], vals);
+            loop_env = extend_env(vm, env, vars, vals);
+        }
+    }
+    return syntax_begin(vm, exit, loop_env);
+}
+struct object* syntax_set(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     // (set! x y)
     struct object* var = cadr(exp);  // symbol
-    struct object* val = eval(caddr(exp), env);
-    return set_variable(var, val, env);
+    struct object* val = eval(vm, caddr(exp), env);
+    return set_variable(vm, var, val, env);
 }
 
-struct object* syntax_set_car(struct object* exp, struct object* env) {
+struct object* syntax_set_car(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     // (set-car! x y)
-    struct object* var = eval(cadr(exp), env);  // eval x
-    struct object* val = eval(caddr(exp), env);  // eval y
+    struct object* var = eval(vm, cadr(exp), env);  // eval x
+    struct object* val = eval(vm, caddr(exp), env);  // eval y
+    REQUIRE(var, LIST);
+    if (!var) raise_error(vm, NULL, "set-car!: empty list");
     var->car = val;
-    return set_variable(cadr(exp), var, env);  // set variable
+    return var;
 }
 
-struct object* syntax_set_cdr(struct object* exp, struct object* env) {
+struct object* syntax_set_cdr(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     // (set-cdr! x y)
-    struct object* name = cadr(exp);
-    struct object* var = eval(name, env);
-    struct object* val = eval(caddr(exp), env);
+    struct object* var = eval(vm, cadr(exp), env);
+    struct object* val = eval(vm, caddr(exp), env);
+    REQUIRE(var, LIST);
+    if (!var) raise_error(vm, NULL, "set-cdr!: empty list");
     var->cdr = val;
-    return set_variable(name, var, env);
+    return var;
+}
+
+struct object* syntax_delay(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (delay <exp>)
+    return mk_promise(vm, cadr(exp), env);
+}
+
+struct object* syntax_cons_stream(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    // (cons-stream a b) <=> (cons a (delay b))
+    return cons(vm, eval(vm, cadr(exp), env), mk_promise(vm, caddr(exp), env));
+}
+
+struct object* syntax_guard(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    /*
+     * (guard (<var> (<test> <e1> ...) ... (else <e1> ...)) <body>)
+     * the error raised by <body> is bound to <var> for the cond-like
+     * clauses; raised again if none of them applies
+     */
+    struct handler h;
+    push_handler(vm, &h);
+    if (!setjmp(h.jmp)) {
+        struct object* val = syntax_begin(vm, cdr(exp), env);
+        pop_handler(vm, &h);
+        return val;
+    }
+    struct object* err = vm->raised;
+    struct object* guard_env = mk_env(vm, env);
+    define_variable(vm, car(cadr(exp)), err, guard_env);
+    for (struct object* clauses = cdr(cadr(exp)); clauses; clauses = cdr(clauses)) {
+        struct object* clause = car(clauses);
+        struct object* test = eval(vm, car(clause), guard_env);
+        if (test == vm->false_obj) continue;
+        return cdr(clause) ? syntax_begin(vm, clause, guard_env) : test;
+    }
+    raise_object(vm, err);
 }
 
-struct object* syntax_not_supported(struct object* exp, struct object* env) {
+struct object* syntax_not_supported(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     printf("SYNTAX NOT SUPPORTED:\n");
     print(exp);
     printf("\n");
@@ -665,26 +1886,34 @@ struct object* syntax_not_supported(struct object* exp, struct object* env) {
 /*========================================================
  * evaluator
  * =======================================================*/
-struct object* eval_args(struct object* args, struct object* env) {
+struct object* eval_args(struct sparrow_vm* vm, struct object* args, struct object* env) {
     struct object* l = NULL;
+    long n = 0;
     while (args) {
         struct object* arg = car(args);
-        l = cons(eval(arg, env), l);
+        l = cons(vm, eval(vm, arg, env), l);
         args = cdr(args);
+        n++;
     }
-    return reverse(l);
+    vm->heap.arg_lists++;
+    vm->heap.arg_conses += 2 * n;  // built reversed, then reversed again
+    return reverse(vm, l);
 }
 
-struct object* eval_list(struct object* exp, struct object* env) {
-    struct object* func = eval(car(exp), env);  // eval operator
+struct object* eval_list(struct sparrow_vm* vm, struct object* exp, struct object* env) {
+    struct object* func = eval(vm, car(exp), env);  // eval operator
     switch (func->type) {
         case SYNTAX:  // special forms
-                return (func->syntax)(exp, env);
+                return (func->syntax)(vm, exp, env);
         case PRIMITIVE:
                 {
-                    struct object* args = eval_args(cdr(exp), env);
-                    exp = cons(func, args);
-                    return (func->primitive)(exp);
+                    struct object* args = eval_args(vm, cdr(exp), env);
+                    exp = cons(vm, func, args);
+                    struct call_frame frame;
+                    push_frame(vm, &frame, func->prim_name);
+                    struct object* ret = (func->primitive)(vm, exp);
+                    pop_frame(vm, &frame);
+                    return ret;
                 }
         case PROCEDURE:
             {
@@ -692,34 +1921,76 @@ struct object* eval_list(struct object* exp, struct object* env) {
                 // eval operands
                 struct object* params = func->params;
                 struct object* args = cdr(exp);
-                struct object* new_env = mk_env(func->env);
+                struct object* new_env = mk_env(vm, func->env);
                 while (params && args) {
                     struct object* param = car(params);
-                    if (param == mk_sym(".")) {  // varidic args
-                        struct object* l = eval_args(args, env);
-                        define_variable(cadr(params), l, new_env);
+                    if (param == vm->sym.dot) {  // varidic args
+                        struct object* l = eval_args(vm, args, env);
+                        define_variable(vm, cadr(params), l, new_env);
                         break;
                     }
-                    define_variable(param, eval(car(args), env), new_env);
+                    define_variable(vm, param, eval(vm, car(args), env), new_env);
                     params = cdr(params);
                     args = cdr(args);
                 }
                 struct object* body = func->body;
-                return eval(body, new_env);  // apply
+                struct call_frame frame;
+                push_frame(vm, &frame, func->name);
+                struct object* ret = eval(vm, body, new_env);  // apply
+                pop_frame(vm, &frame);
+                return ret;
             }
             break;
+        case MEMOIZED:
+            return memo_apply(vm, func, eval_args(vm, cdr(exp), env));
+        case MACRO:
+            return eval(vm, expansion(vm, func, exp), env);
         default:
-            print(exp); newline(); 
-            print(car(exp));
-            printf(" has type: %s, which is not appliable!\n", types_str[func->type]);
-            abort();
-            break;
+            raise_error(vm, list(vm, 1, car(exp)), "not applicable");
     }
     return NULL;
 }
 
-struct object* eval(struct object* exp, struct object* env) {
+// apply 'func' to a list of evaluated 'args'
+struct object* apply(struct sparrow_vm* vm, struct object* func, struct object* args) {
+    struct call_frame frame;
+    struct object* ret = NULL;
+    switch (func->type) {
+        case PRIMITIVE:
+            push_frame(vm, &frame, func->prim_name);
+            ret = (func->primitive)(vm, cons(vm, func, args));
+            pop_frame(vm, &frame);
+            return ret;
+        case PROCEDURE:
+            {
+                struct object* params = func->params;
+                struct object* new_env = mk_env(vm, func->env);
+                while (params) {
+                    if (car(params) == vm->sym.dot) {  // varidic args
+                        define_variable(vm, cadr(params), args, new_env);
+                        break;
+                    }
+                    if (!args) break;
+                    define_variable(vm, car(params), car(args), new_env);
+                    params = cdr(params);
+                    args = cdr(args);
+                }
+                push_frame(vm, &frame, func->name);
+                ret = eval(vm, func->body, new_env);
+                pop_frame(vm, &frame);
+                return ret;
+            }
+        case MEMOIZED:
+            return memo_apply(vm, func, args);
+        default:
+            raise_error(vm, list(vm, 1, func), "not applicable");
+    }
+    return NULL;
+}
+
+struct object* eval(struct sparrow_vm* vm, struct object* exp, struct object* env) {
     if (!exp || exp == g_dummy) return exp;
+    if (vm->sched.spawned && vm->sched.ready && --vm->sched.budget <= 0) task_yield(vm);  // preempt
     switch (exp->type) {
         case NUMBER:
         case STRING:
@@ -728,31 +1999,1150 @@ struct object* eval(struct object* exp, struct object* env) {
         case SYMBOL:
             {
                 struct object* val = lookup_variable(exp, env);
-                if (val == g_dummy) {
-                    printf("Unbound Symbol: %s\n", exp->s) ;
-                    abort();
-                }
+                if (val == g_dummy) raise_error(vm, list(vm, 1, exp), "unbound symbol");
                 return val;
             }
         case LIST:
-            return eval_list(exp, env);
+            return eval_list(vm, exp, env);
            break;
         default:
             return NULL;
     }
 }
 
+/*========================================================
+ * optimizer
+ * =======================================================*/
+/*
+ * the bodies of procedures made by define and lambda in the global
+ * environment are rewritten once: applications of pure primitives to
+ * constants are folded, if and cond drop the branches their constant
+ * tests rule out, and calls to small global procedures made of nothing
+ * but pure primitives are inlined. none of this touches a symbol bound
+ * anywhere in the procedure, so what is left are globals; every global
+ * a rewrite relied on is recorded in vm->deps, and once it is defined or
+ * set! again, the procedures relying on it get their source back, as do
+ * the procedures which inlined those, whatever global they called. nested
+ * lambdas are rewritten as part of the body they appear in.
+ */
+#define OPT_INLINE_SIZE 24  // nodes of an inlined body
+
+struct opt {
+    struct object* bound;  // symbols bound anywhere in the procedure
+    struct object* deps;  // globals the rewrites relied on
+    bool inline_calls;  // not in a body being inlined
+    bool expand;  // macro uses, unless scanning a template
+    bool local_macros;  // defined in the procedure, which leave it as it is
+};
+
+static bool memq(struct object* x, struct object* l) {
+    for (; l; l = cdr(l)) if (car(l) == x) return true;
+    return false;
+}
+
+// primitives with no side effects
+static bool opt_pure(primitive_t p) {
+    return p == prim_add || p == prim_subtract || p == prim_multiply || p == prim_divide || p == prim_mod ||
+           p == prim_num_eq || p == prim_num_lt || p == prim_not || p == prim_eq || p == prim_isnull ||
+           p == prim_is_pair || p == prim_is_symbol || p == prim_is_number || p == prim_is_string ||
+           p == prim_car || p == prim_cdr || p == prim_cons || p == prim_length;
+}
+
+static void opt_bind(struct opt* o, struct sparrow_vm* vm, struct object* x) {
+    if (x && x != g_dummy && x->type == SYMBOL && !memq(x, o->bound)) o->bound = cons(vm, x, o->bound);
+    for (; x && x != g_dummy && x->type == LIST; x = cdr(x)) opt_bind(o, vm, car(x));
+}
+
+// the expansion of the use 'form' of 'macro', g_dummy if expanding it raised
+static struct object* opt_expansion(struct sparrow_vm* vm, struct object* macro, struct object* form) {
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) return g_dummy;  // leave the error to run time
+    struct object* exp = expansion(vm, macro, form);
+    pop_handler(vm, &h);
+    return exp;
+}
+
+// collect in o->bound whatever 'exp' binds: parameters, definitions, let variables...
+static void opt_scan(struct sparrow_vm* vm, struct opt* o, struct object* exp) {
+    if (!exp || exp == g_dummy || exp->type != LIST) return;
+    struct object* op = car(exp);
+    struct object* f = op && op->type == SYMBOL ? lookup_variable(op, vm->global_env) : g_dummy;
+    if (o->expand && f && f != g_dummy && f->type == MACRO) {
+        opt_scan(vm, o, opt_expansion(vm, f, exp));
+        return;
+    }
+    if (f && f != g_dummy && f->type == SYNTAX && cdr(exp)) {
+        syntax_t s = f->syntax;
+        if (s == syntax_quote) return;
+        if (s == syntax_define_macro || s == syntax_define_syntax) o->local_macros = true;
+        if (s == syntax_lambda || s == syntax_define || s == syntax_define_memoized || s == syntax_guard) {
+            opt_bind(o, vm, s == syntax_guard ? car(cadr(exp)) : cadr(exp));
+        } else if (s == syntax_let || s == syntax_let_star || s == syntax_letrec || s == syntax_do) {
+            struct object* bindings = cadr(exp);
+            if (bindings && bindings->type == SYMBOL) {  // named let
+                opt_bind(o, vm, bindings);
+                bindings = cddr(exp) ? caddr(exp) : NULL;
+            }
+            for (; bindings && bindings->type == LIST; bindings = cdr(bindings)) {
+                if (car(bindings) && car(bindings)->type == LIST) opt_bind(o, vm, car(car(bindings)));
+            }
+        }
+    }
+    for (; exp && exp->type == LIST; exp = cdr(exp)) opt_scan(vm, o, car(exp));
+}
+
+// the global value of the symbol 'x', g_dummy if it's bound in the procedure or unbound
+static struct object* opt_global(struct sparrow_vm* vm, struct opt* o, struct object* x) {
+    if (!x || x->type != SYMBOL || memq(x, o->bound)) return g_dummy;
+    return lookup_variable(x, vm->global_env);
+}
+
+// the special form the head 'x' of a form stands for, NULL if none
+static syntax_t opt_syntax(struct sparrow_vm* vm, struct opt* o, struct object* x) {
+    struct object* f = opt_global(vm, o, x);
+    return f && f != g_dummy && f->type == SYNTAX ? f->syntax : NULL;
+}
+
+static void opt_depend(struct sparrow_vm* vm, struct opt* o, struct object* x) {
+    if (!memq(x, o->deps)) o->deps = cons(vm, x, o->deps);
+}
+
+// is 'exp' a constant? its value is left in 'val'
+static bool opt_constant(struct sparrow_vm* vm, struct opt* o, struct object* exp, struct object** val) {
+    if (!exp || exp->type == NUMBER || exp->type == STRING || exp->type == BOOLEAN) {
+        *val = exp;
+        return true;
+    }
+    if (exp->type != LIST || opt_syntax(vm, o, car(exp)) != syntax_quote) return false;
+    *val = cadr(exp);
+    return true;
+}
+
+// 'l' itself unless its car or cdr changed
+static struct object* opt_cons(struct sparrow_vm* vm, struct object* l, struct object* a, struct object* d) {
+    if (a == car(l) && d == cdr(l)) return l;
+    struct object* c = cons(vm, a, d);
+    c->source = l->source;
+    return c;
+}
+
+static struct object* opt_exp(struct sparrow_vm* vm, struct opt* o, struct object* exp);
+
+static struct object* opt_list(struct sparrow_vm* vm, struct opt* o, struct object* l) {
+    if (!l || l == g_dummy || l->type != LIST) return l;
+    return opt_cons(vm, l, opt_exp(vm, o, car(l)), opt_list(vm, o, cdr(l)));
+}
+
+// 'l' with all but its first 'n' elements rewritten
+static struct object* opt_rest(struct sparrow_vm* vm, struct opt* o, struct object* l, int n) {
+    if (!n) return opt_list(vm, o, l);
+    if (!l || l == g_dummy || l->type != LIST) return l;
+    return opt_cons(vm, l, car(l), opt_rest(vm, o, cdr(l), n - 1));
+}
+
+// ((<var> <exp> ...) ...)
+static struct object* opt_bindings(struct sparrow_vm* vm, struct opt* o, struct object* l) {
+    if (!l || l == g_dummy || l->type != LIST) return l;
+    return opt_cons(vm, l, opt_rest(vm, o, car(l), 1), opt_bindings(vm, o, cdr(l)));
+}
+
+static struct object* opt_if(struct sparrow_vm* vm, struct opt* o, struct object* exp) {
+    struct object* test = opt_exp(vm, o, cadr(exp));
+    struct object* val;
+    if (opt_constant(vm, o, test, &val)) {
+        if (val != vm->false_obj) return opt_exp(vm, o, caddr(exp));
+        if (cdr(cddr(exp))) return opt_exp(vm, o, cadr(cddr(exp)));
+    }
+    return opt_cons(vm, exp, car(exp), opt_cons(vm, cdr(exp), test, opt_list(vm, o, cddr(exp))));
+}
+
+static struct object* opt_cond(struct sparrow_vm* vm, struct opt* o, struct object* exp) {
+    struct object* clauses = NULL;
+    bool changed = false;
+    for (struct object* l = cdr(exp); l; l = cdr(l)) {
+        if (!car(l) || car(l)->type != LIST) return exp;
+        struct object* clause = opt_list(vm, o, car(l));
+        struct object* val;
+        bool constant = opt_constant(vm, o, car(clause), &val);
+        changed |= clause != car(l);
+        if (constant && val == vm->false_obj) {  // never taken
+            changed = true;
+            continue;
+        }
+        if (constant && !clauses && cdr(clause)) return cadr(clause);  // always taken
+        clauses = cons(vm, clause, clauses);
+        if (constant) {  // the rest are never reached
+            changed |= cdr(l) != NULL;
+            break;
+        }
+    }
+    return changed ? cons(vm, car(exp), reverse(vm, clauses)) : exp;
+}
+
+// 'exp' with the symbols in 'vars' replaced by the matching 'vals'
+static struct object* opt_subst(struct sparrow_vm* vm, struct object* exp, struct object* vars, struct object* vals) {
+    if (exp && exp->type == SYMBOL) {
+        for (; vars; vars = cdr(vars), vals = cdr(vals)) if (car(vars) == exp) return car(vals);
+        return exp;
+    }
+    if (!exp || exp->type != LIST || car(exp) == vm->sym.quote) return exp;
+    return cons(vm, opt_subst(vm, car(exp), vars, vals), opt_subst(vm, cdr(exp), vars, vals));
+}
+
+// can 'exp', the body of 'proc', go in place of a call? so no more than pure
+// primitives, if and quote, and no global the caller binds itself
+static bool opt_inlinable(struct sparrow_vm* vm, struct opt* o, struct object* proc, struct object* exp, int* size) {
+    if (--*size < 0) return false;
+    if (!exp || exp->type == NUMBER || exp->type == STRING || exp->type == BOOLEAN) return true;
+    if (exp->type == SYMBOL) return memq(exp, proc->params) || !memq(exp, o->bound);
+    if (exp->type != LIST) return false;
+    if (opt_syntax(vm, o, car(exp)) == syntax_quote) return true;
+    if (memq(car(exp), proc->params)) return false;
+    struct object* f = opt_global(vm, o, car(exp));
+    if (!(f && f != g_dummy && f->type == PRIMITIVE && opt_pure(f->primitive)) && opt_syntax(vm, o, car(exp)) != syntax_if) {
+        return false;
+    }
+    for (exp = cdr(exp); exp; exp = cdr(exp)) {
+        if (exp->type != LIST || !opt_inlinable(vm, o, proc, car(exp), size)) return false;
+    }
+    return true;
+}
+
+// how many times the inlinable 'exp' evaluates 'var', 2 standing for
+// more than once and for maybe, in a branch of an if
+static int opt_uses(struct sparrow_vm* vm, struct opt* o, struct object* exp, struct object* var) {
+    if (exp == var) return 1;
+    if (!exp || exp->type != LIST) return 0;
+    syntax_t s = opt_syntax(vm, o, car(exp));
+    if (s == syntax_quote) return 0;
+    int n = 0;
+    for (struct object* l = cdr(exp); l; l = cdr(l)) {
+        int k = opt_uses(vm, o, car(l), var);
+        n += s == syntax_if && l != cdr(exp) && k ? 2 : k;
+    }
+    return n < 2 ? n : 2;
+}
+
+/*
+ * the body of 'proc' in place of 'call'. the arguments are substituted
+ * when they are constants or variables, which the pure body may look up
+ * at any time, or when a lone other argument is evaluated exactly once
+ * anyway. otherwise they are bound by a let, which evaluates them once
+ * and in order like the call did
+ */
+static struct object* opt_inline(struct sparrow_vm* vm, struct opt* o, struct object* call, struct object* proc) {
+    if (!o->inline_calls || proc->env != vm->global_env) return NULL;
+    struct object* params = proc->params;
+    struct object* args = cdr(call);
+    int size = OPT_INLINE_SIZE;
+    if (memq(vm->sym.dot, params) || len(vm, params) != len(vm, args)) return NULL;
+    if (!opt_inlinable(vm, o, proc, proc->body, &size)) return NULL;
+    int variables = 0, others = 0;
+    struct object *val, *other = NULL;
+    for (struct object *l = args, *p = params; l; l = cdr(l), p = cdr(p)) {
+        if (opt_constant(vm, o, car(l), &val)) continue;
+        if (car(l)->type == SYMBOL) {
+            variables++;
+        } else {
+            others++;
+            other = car(p);
+        }
+    }
+    bool simple = !others || (others == 1 && !variables && opt_uses(vm, o, proc->body, other) == 1);
+    struct object *vars = NULL, *vals = NULL, *bindings = NULL;
+    for (; params; params = cdr(params), args = cdr(args)) {
+        if (simple || opt_constant(vm, o, car(args), &val)) {
+            vars = cons(vm, car(params), vars);
+            vals = cons(vm, car(args), vals);
+        } else {
+            bindings = cons(vm, list(vm, 2, car(params), car(args)), bindings);
+            opt_bind(o, vm, car(params));  // within the let
+        }
+    }
+    struct object* body = opt_subst(vm, proc->body, vars, vals);
+    if (bindings) {
+        if (opt_syntax(vm, o, vm->sym.let) != syntax_let) return NULL;
+        body = list(vm, 3, vm->sym.let, reverse(vm, bindings), body);
+    }
+    o->inline_calls = false;  // but fold what the arguments made constant
+    body = opt_exp(vm, o, body);
+    o->inline_calls = true;
+    return body;
+}
+
+// the value of applying the pure primitive 'prim' to constants, NULL if it raised
+static struct object* opt_fold(struct sparrow_vm* vm, struct opt* o, struct object* prim, struct object* args) {
+    struct object *vals = NULL, *val;
+    for (; args; args = cdr(args)) {
+        if (!opt_constant(vm, o, car(args), &val)) return NULL;
+        vals = cons(vm, val, vals);
+    }
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) return NULL;  // leave the error to run time
+    val = (prim->primitive)(vm, cons(vm, prim, reverse(vm, vals)));
+    pop_handler(vm, &h);
+    return val && (val->type == NUMBER || val->type == BOOLEAN) ? val : NULL;
+}
+
+static struct object* opt_exp(struct sparrow_vm* vm, struct opt* o, struct object* exp) {
+    if (exp && exp->type == SYMBOL) {  // #t, #f and else are constants by convention, other globals aren't
+        if (exp->s[0] != '#' && strcmp(exp->s, "else")) return exp;
+        struct object* val = opt_global(vm, o, exp);
+        if (val == g_dummy || !val || val->type != BOOLEAN) return exp;
+        opt_depend(vm, o, exp);
+        return val;
+    }
+    if (!exp || exp == g_dummy || exp->type != LIST) return exp;
+    syntax_t s = opt_syntax(vm, o, car(exp));
+    if (s) {
+        if (!cdr(exp)) return exp;
+        if (s == syntax_if) return opt_if(vm, o, exp);
+        if (s == syntax_cond) return opt_cond(vm, o, exp);
+        if (s == syntax_begin || s == syntax_delay || s == syntax_cons_stream) return opt_rest(vm, o, exp, 1);
+        if (s == syntax_lambda || s == syntax_define || s == syntax_set || s == syntax_guard) return opt_rest(vm, o, exp, 2);
+        if (s == syntax_let && cadr(exp) && cadr(exp)->type == SYMBOL) {  // named
+            struct object* rest = cddr(exp);
+            return opt_cons(vm, exp, car(exp), opt_cons(vm, cdr(exp), cadr(exp),
+                        opt_cons(vm, rest, opt_bindings(vm, o, car(rest)), opt_list(vm, o, cdr(rest)))));
+        }
+        if (s == syntax_let || s == syntax_let_star || s == syntax_letrec || s == syntax_do) {
+            return opt_cons(vm, exp, car(exp), opt_cons(vm, cdr(exp), opt_bindings(vm, o, cadr(exp)),
+                        opt_list(vm, o, cddr(exp))));
+        }
+        return exp;  // quote, set-car!...
+    }
+    struct object* f = opt_global(vm, o, car(exp));
+    if (f && f != g_dummy && f->type == MACRO) {
+        struct object* expanded = opt_expansion(vm, f, exp);
+        if (expanded == g_dummy) return exp;
+        opt_depend(vm, o, car(exp));
+        return opt_exp(vm, o, expanded);
+    }
+    struct object* call = opt_list(vm, o, exp);
+    struct object* val = NULL;
+    if (f && f != g_dummy && f->type == PRIMITIVE && opt_pure(f->primitive)) val = opt_fold(vm, o, f, cdr(call));
+    if (f && f != g_dummy && f->type == PROCEDURE) val = opt_inline(vm, o, call, f);
+    if (!val) return call;
+    opt_depend(vm, o, car(exp));
+    if (f->type == PROCEDURE) opt_depend(vm, o, f);  // its body may go back to its source
+    return val;
+}
+
+// rewrite the body of 'proc', just made by define or lambda
+void optimize(struct sparrow_vm* vm, struct object* proc) {
+    if (proc->env != vm->global_env || vm->owner) return;  // workers can't define anyway
+    struct opt o = {NULL, NULL, true, true, false};
+    opt_bind(&o, vm, proc->params);
+    if (proc->name != vm->sym.lambda) opt_bind(&o, vm, proc->name);
+    opt_scan(vm, &o, proc->body);
+    if (o.local_macros) return;
+    struct object* source = proc->body;
+    proc->body = opt_exp(vm, &o, source);
+    if (proc->body == source) return;
+    for (struct object* l = o.deps; l; l = cdr(l)) {
+        struct object** slot = table_slot(&vm->deps, car(l));
+        *slot = cons(vm, cons(vm, proc, source), *slot);
+    }
+}
+
+// the global 'var' is about to change: the procedures rewritten on the
+// strength of it, and those which inlined them under any name, run their
+// source again. deps are kept for inlined procedures as well as globals
+void deoptimize(struct sparrow_vm* vm, struct object* var) {
+    struct object** slot = table_find(&vm->deps, var);
+    if (!slot) return;
+    struct object* l = *slot;
+    *slot = NULL;
+    for (; l; l = cdr(l)) {
+        struct object* proc = car(car(l));
+        if (proc->body == cdr(car(l))) continue;
+        proc->body = cdr(car(l));
+        deoptimize(vm, proc);
+    }
+}
+
+/*========================================================
+ * macros
+ * =======================================================*/
+/*
+ * a macro use is expanded the first time it is evaluated, and its call
+ * site remembers the expansion for as long as the macro isn't redefined.
+ * syntax-rules substitutes the pattern variables of the first matching
+ * rule into its template, where 'x ...' repeats 'x' for every match. it's
+ * hygienic enough: the variables the template binds itself are renamed
+ * afresh for every expansion, so they can't capture the user's, but free
+ * symbols of the template mean whatever they mean at the call site.
+ */
+
+// (var depth . value), where the value of a var under n ellipses is a list nested n deep
+static struct object* pattern_bind(struct sparrow_vm* vm, struct object* var, int depth, struct object* value,
+                                   struct object* b) {
+    return cons(vm, cons(vm, var, cons(vm, mk_integer(vm, depth), value)), b);
+}
+
+static struct object* assq(struct object* x, struct object* alist) {
+    for (; alist; alist = cdr(alist)) if (car(car(alist)) == x) return car(alist);
+    return NULL;
+}
+
+static bool pattern_match(struct sparrow_vm* vm, struct object* literals, struct object* pat, struct object* form,
+                          struct object** b) {
+    if (pat && pat->type == SYMBOL) {
+        if (memq(pat, literals)) return form == pat;
+        if (pat != vm->sym.underscore) *b = pattern_bind(vm, pat, 0, form, *b);
+        return true;
+    }
+    if (!pat || pat->type != LIST) return is_equal(pat, form);
+    if (car(pat) == vm->sym.dot) return pattern_match(vm, literals, cadr(pat), form, b);  // (a . rest)
+    if (cdr(pat) && cadr(pat) == vm->sym.ellipsis) {
+        // <p> ... <rest>: as many <p> as leaves enough forms for <rest>
+        struct object* rest = cddr(pat);
+        int n = 0, min = 0;
+        for (struct object* l = form; l && l->type == LIST; l = cdr(l)) n++;
+        for (struct object* l = rest; l && car(l) != vm->sym.dot; l = cdr(l)) min++;
+        if (n < min) return false;
+        struct object* matches = NULL;  // of each <p>, last first
+        for (int i = 0; i < n - min; i++, form = cdr(form)) {
+            struct object* sub = NULL;
+            if (!pattern_match(vm, literals, car(pat), car(form), &sub)) return false;
+            matches = cons(vm, sub, matches);
+        }
+        struct object* vars = NULL;
+        pattern_match(vm, NULL, car(pat), car(pat), &vars);  // binds every variable of <p>
+        for (; vars; vars = cdr(vars)) {
+            struct object* var = car(car(vars));
+            if (memq(var, literals)) continue;
+            struct object *values = NULL, *depth = NULL;
+            for (struct object* m = matches; m; m = cdr(m)) {
+                struct object* binding = assq(var, car(m));
+                depth = cadr(binding);
+                values = cons(vm, cddr(binding), values);
+            }
+            *b = pattern_bind(vm, var, depth ? depth->integer + 1 : 1, values, *b);
+        }
+        return pattern_match(vm, literals, rest, form, b);
+    }
+    if (!form || form->type != LIST) return false;
+    return pattern_match(vm, literals, car(pat), car(form), b) && pattern_match(vm, literals, cdr(pat), cdr(form), b);
+}
+
+// the variables under an ellipsis in 'tmpl'
+static struct object* template_vars(struct sparrow_vm* vm, struct object* tmpl, struct object* b, struct object* vars) {
+    if (tmpl && tmpl->type == SYMBOL) {
+        struct object* binding = assq(tmpl, b);
+        return binding && cadr(binding)->integer > 0 && !memq(tmpl, vars) ? cons(vm, tmpl, vars) : vars;
+    }
+    for (; tmpl && tmpl->type == LIST; tmpl = cdr(tmpl)) vars = template_vars(vm, car(tmpl), b, vars);
+    return vars;
+}
+
+static struct object* template_expand(struct sparrow_vm* vm, struct object* tmpl, struct object* b) {
+    if (tmpl && tmpl->type == SYMBOL) {
+        struct object* binding = assq(tmpl, b);
+        return binding ? cddr(binding) : tmpl;
+    }
+    if (!tmpl || tmpl->type != LIST) return tmpl;
+    if (car(tmpl) == vm->sym.ellipsis && cdr(tmpl)) return cadr(tmpl);  // (... ...) is a plain ...
+    if (car(tmpl) == vm->sym.dot) return template_expand(vm, cadr(tmpl), b);
+    if (!cdr(tmpl) || cadr(tmpl) != vm->sym.ellipsis) {
+        return cons(vm, template_expand(vm, car(tmpl), b), template_expand(vm, cdr(tmpl), b));
+    }
+    struct object* vars = template_vars(vm, car(tmpl), b, NULL);
+    if (!vars) raise_error(vm, list(vm, 1, car(tmpl)), "syntax-rules: no pattern variable before ...");
+    struct object* seqs = NULL;  // what is left of the values of each var
+    for (struct object* l = vars; l; l = cdr(l)) seqs = cons(vm, cddr(assq(car(l), b)), seqs);
+    seqs = reverse(vm, seqs);
+    struct object* out = NULL;
+    while (car(seqs)) {
+        struct object* b1 = b;
+        for (struct object *l = vars, *s = seqs; l; l = cdr(l), s = cdr(s)) {
+            if (!car(s)) raise_error(vm, vars, "syntax-rules: different numbers of matches for");
+            b1 = pattern_bind(vm, car(l), cadr(assq(car(l), b))->integer - 1, car(car(s)), b1);
+            s->car = cdr(car(s));
+        }
+        out = cons(vm, template_expand(vm, car(tmpl), b1), out);
+    }
+    return append(vm, reverse(vm, out), template_expand(vm, cddr(tmpl), b));
+}
+
+// 'exp' with the symbols of 'renames' replaced
+static struct object* template_rename(struct sparrow_vm* vm, struct object* exp, struct object* renames) {
+    if (exp && exp->type == SYMBOL) {
+        struct object* r = assq(exp, renames);
+        return r ? cdr(r) : exp;
+    }
+    if (!exp || exp->type != LIST || car(exp) == vm->sym.quote) return exp;
+    return cons(vm, template_rename(vm, car(exp), renames), template_rename(vm, cdr(exp), renames));
+}
+
+static struct object* macro_expand(struct sparrow_vm* vm, struct object* macro, struct object* form) {
+    if (macro->expander) return apply(vm, macro->expander, cdr(form));
+    for (struct object* rules = macro->rules; rules; rules = cdr(rules)) {
+        struct object* pattern = car(car(rules));
+        struct object* tmpl = cadr(car(rules));
+        struct object* b = NULL;
+        if (!pattern || pattern->type != LIST) raise_error(vm, list(vm, 1, pattern), "syntax-rules: bad pattern");
+        if (!pattern_match(vm, macro->literals, cdr(pattern), cdr(form), &b)) continue;
+        struct opt o = {NULL, NULL, false, false, false};
+        opt_scan(vm, &o, tmpl);
+        struct object* renames = NULL;
+        for (struct object* l = o.bound; l; l = cdr(l)) {
+            struct object* var = car(l);
+            if (assq(var, b) || var == vm->sym.ellipsis || var == vm->sym.dot || var == vm->sym.underscore) continue;
+            renames = cons(vm, cons(vm, var, gensym(vm, var->s)), renames);
+        }
+        return template_expand(vm, template_rename(vm, tmpl, renames), b);
+    }
+    raise_error(vm, list(vm, 1, form), "no syntax-rules pattern matches");
+}
+
+// mark the forms of 'exp' as source, they are going to stay around
+void mark_source(struct object* exp) {
+    for (; exp && exp != g_dummy && exp->type == LIST && !exp->source; exp = cdr(exp)) {
+        exp->source = true;
+        mark_source(car(exp));
+    }
+}
+
+// the expansion of 'form', a use of 'macro', once per call site. forms
+// built at run time, like code given to eval, are expanded every time
+// unless they are in a procedure body: caching them would keep an entry
+// per evaluation forever
+struct object* expansion(struct sparrow_vm* vm, struct object* macro, struct object* form) {
+    if (!form->source) return macro_expand(vm, macro, form);
+    struct object** slot = table_find(&vm->expansions, form);
+    if (slot && *slot && car(*slot) == macro) return cdr(*slot);
+    struct object* exp = macro_expand(vm, macro, form);
+    mark_source(exp);
+    *table_slot(&vm->expansions, form) = cons(vm, macro, exp);  // after, expanding may have grown the table
+    return exp;
+}
+
+/*========================================================
+ * thread pool
+ * =======================================================*/
+/*
+ * parallel-map splits its input into chunks which are spread over the
+ * deques of a fixed set of worker threads. a worker pops chunks from the
+ * tail of its own deque and, once that is empty, steals from the head of
+ * the others; the caller of parallel-map steals too. every worker
+ * evaluates with its own vm: a copy of the owner sharing the symbol table
+ * and the global environment, but with its own heap and call stack. so
+ * the callbacks may read globals, but defining or setting one raises an
+ * error (see require_global_write).
+ */
+#define POOL_CHUNKS_PER_THREAD 4
+struct pool_chunk {
+    int begin, end;
+};
+struct deque {
+    pthread_mutex_t lock;
+    struct pool_chunk* chunks;
+    int head, tail;  // owner pops at the tail, thieves steal at the head
+    int cap;
+};
+struct worker {
+    struct pool* pool;
+    struct sparrow_vm* vm;
+    struct deque dq;
+    pthread_t thread;
+};
+struct pool {
+    int n;  // worker threads
+    struct worker* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    unsigned long generation;  // bumped for every job
+    int pending;  // chunks of the job not finished yet
+    bool shutdown;
+    bool busy;  // owner is waiting for a job
+    struct object* error;  // the first one raised by the job
+    // the job
+    struct object* func;
+    struct object** items;
+    struct object** results;
+};
+
+static bool deque_pop(struct deque* dq, struct pool_chunk* chunk, bool steal) {
+    pthread_mutex_lock(&dq->lock);
+    bool found = dq->head < dq->tail;
+    if (found) *chunk = steal ? dq->chunks[dq->head++] : dq->chunks[--dq->tail];
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+// run chunks until there are none left; 'self' is -1 for the owner's thread
+static void pool_work(struct pool* pool, struct sparrow_vm* vm, int self) {
+    struct pool_chunk chunk;
+    while (true) {
+        bool found = self >= 0 && deque_pop(&pool->workers[self].dq, &chunk, false);
+        for (int i = 1; !found && i <= pool->n; i++) {
+            int victim = (self + i + pool->n) % pool->n;
+            found = deque_pop(&pool->workers[victim].dq, &chunk, true);
+        }
+        if (!found) return;
+        struct handler h;
+        push_handler(vm, &h);
+        if (setjmp(h.jmp)) {  // give up the chunk, the owner raises it again
+            pthread_mutex_lock(&pool->lock);
+            if (!pool->error) pool->error = vm->raised;
+            pthread_mutex_unlock(&pool->lock);
+        } else {
+            for (int i = chunk.begin; i < chunk.end; i++) {
+                pool->results[i] = apply(vm, pool->func, cons(vm, pool->items[i], NULL));
+            }
+            pop_handler(vm, &h);
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void* worker_main(void* arg) {
+    struct worker* w = arg;
+    struct pool* pool = w->pool;
+    unsigned long seen = 0;
+    prof_vm = w->vm;  // its samples go to the owner's profile
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->shutdown && pool->generation == seen) pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->shutdown) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        pool_work(pool, w->vm, w - pool->workers);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// SPARROW_THREADS or one thread per cpu, counting the caller's
+static struct pool* pool_create(struct sparrow_vm* vm) {
+    const char* env = getenv("SPARROW_THREADS");
+    int threads = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    struct pool* pool = malloc(sizeof(struct pool));
+    memset(pool, 0, sizeof(struct pool));
+    pool->n = threads > 1 ? threads - 1 : 0;
+    pool->workers = malloc(sizeof(struct worker) * (pool->n + 1));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int i = 0; i < pool->n; i++) {
+        struct worker* w = &pool->workers[i];
+        w->pool = pool;
+        w->vm = malloc(sizeof(struct sparrow_vm));
+        *w->vm = *vm;
+        w->vm->owner = vm;
+        w->vm->pool = NULL;
+        w->vm->chunks = NULL;
+        w->vm->frames = NULL;
+        w->vm->handlers = NULL;
+        memset(&w->vm->heap, 0, sizeof(w->vm->heap));
+        memset(&w->vm->prof, 0, sizeof(w->vm->prof));
+        memset(&w->vm->sched, 0, sizeof(w->vm->sched));
+        memset(&w->vm->forms, 0, sizeof(w->vm->forms));
+        memset(&w->vm->deps, 0, sizeof(w->vm->deps));
+        memset(&w->vm->expansions, 0, sizeof(w->vm->expansions));
+        memset(&w->dq, 0, sizeof(struct deque));
+        pthread_mutex_init(&w->dq.lock, NULL);
+    }
+    pthread_mutex_init(&vm->sym_lock, NULL);
+    vm->pool = pool;  // from now on mk_sym locks
+    for (int i = 0; i < pool->n; i++) {
+        pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]);
+    }
+    return pool;
+}
+
+static void free_chunks(struct chunk* c);
+
+static void pool_destroy(struct pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->n; i++) {
+        struct worker* w = &pool->workers[i];
+        pthread_join(w->thread, NULL);
+        free_chunks(w->vm->chunks);
+        free(w->vm->forms.keys);
+        free(w->vm->forms.values);
+        free(w->vm->expansions.keys);
+        free(w->vm->expansions.values);
+        free(w->vm);
+        free(w->dq.chunks);
+        pthread_mutex_destroy(&w->dq.lock);
+    }
+    free(pool->workers);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool);
+}
+
+static struct object* pool_map(struct sparrow_vm* vm, struct object* func, struct object* l) {
+    int n = len(vm, l);
+    if (!vm->pool && !vm->owner && n > 1) pool_create(vm);
+    struct pool* pool = vm->pool;
+    if (!pool || !pool->n || pool->busy || n < 2) {  // nested, or nothing to split
+        struct object* results = NULL;
+        for (; l; l = cdr(l)) results = cons(vm, apply(vm, func, cons(vm, car(l), NULL)), results);
+        return reverse(vm, results);
+    }
+
+    struct object** items = malloc(sizeof(struct object*) * n);
+    struct object** results = malloc(sizeof(struct object*) * n);
+    for (int i = 0; l; l = cdr(l), i++) items[i] = car(l);
+    int n_chunks = pool->n * POOL_CHUNKS_PER_THREAD;
+    if (n_chunks > n) n_chunks = n;
+    pool->busy = true;
+    pthread_mutex_lock(&pool->lock);
+    pool->error = NULL;
+    pool->func = func;
+    pool->items = items;
+    pool->results = results;
+    pool->pending = n_chunks;
+    for (int i = 0; i < pool->n; i++) {  // --serve swaps the port per request
+        pool->workers[i].vm->out = vm->out;
+    }
+    for (int i = 0; i < n_chunks; i++) {  // deal the chunks round robin
+        struct deque* dq = &pool->workers[i % pool->n].dq;
+        pthread_mutex_lock(&dq->lock);
+        if (i < pool->n) dq->head = dq->tail = 0;
+        if (dq->tail == dq->cap) {
+            dq->cap = dq->cap ? 2 * dq->cap : POOL_CHUNKS_PER_THREAD;
+            dq->chunks = realloc(dq->chunks, sizeof(struct pool_chunk) * dq->cap);
+        }
+        dq->chunks[dq->tail++] = (struct pool_chunk){(long)n * i / n_chunks, (long)n * (i + 1) / n_chunks};
+        pthread_mutex_unlock(&dq->lock);
+    }
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool, vm, -1);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pool->busy = false;
+
+    // the workers are idle: take over their allocation counters
+    for (int i = 0; i < pool->n; i++) {
+        struct sparrow_vm* w = pool->workers[i].vm;
+        for (int t = 0; t < N_TYPES; t++) {
+            vm->heap.objects[t] += w->heap.objects[t];
+            vm->heap.bytes[t] += w->heap.bytes[t];
+        }
+        vm->heap.arg_lists += w->heap.arg_lists;
+        vm->heap.arg_conses += w->heap.arg_conses;
+        memset(&w->heap, 0, sizeof(w->heap));
+    }
+    struct object* ret = NULL;
+    if (!pool->error) {
+        for (int i = n - 1; i >= 0; i--) ret = cons(vm, results[i], ret);
+    }
+    free(items);
+    free(results);
+    if (pool->error) raise_object(vm, pool->error);
+    return ret;
+}
+
+// apply 'func' to every element of 'l', in parallel; the results are in
+// order. 'func' may not change globals, even where it runs sequentially
+struct object* parallel_map(struct sparrow_vm* vm, struct object* func, struct object* l) {
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) {
+        vm->parallel--;
+        raise_object(vm, vm->raised);
+    }
+    vm->parallel++;
+    struct object* ret = pool_map(vm, func, l);
+    vm->parallel--;
+    pop_handler(vm, &h);
+    return ret;
+}
+
+/*========================================================
+ * tasks
+ * =======================================================*/
+/*
+ * green threads. every task evaluates on a stack of its own and switches
+ * with swapcontext; whatever was evaluating when the first task was
+ * spawned becomes the main task. a task runs until it yields, receives
+ * from an empty channel, finishes, or has done SCHED_BUDGET eval steps
+ * while others are ready. an error a task doesn't catch is reported and
+ * ends it; when every task waits on a channel, the receive of the main
+ * task raises an error. tasks don't outlive the top-level evaluation
+ * that spawned them, see sched_drain.
+ * stacks are mapped lazily, so a parked task costs a few pages, and the
+ * stacks of finished tasks are reused.
+ */
+#define SCHED_BUDGET 10000
+#define TASK_STACK (8 << 20)  // as deep as the main thread's, committed as used
+
+static void task_push(struct task** head, struct task** tail, struct task* t) {
+    t->next = NULL;
+    if (*tail) (*tail)->next = t;
+    else *head = t;
+    *tail = t;
+}
+
+static struct task* task_pop(struct task** head, struct task** tail) {
+    struct task* t = *head;
+    if (t && !(*head = t->next)) *tail = NULL;
+    return t;
+}
+
+static struct task* sched_current(struct sparrow_vm* vm) {
+    if (!vm->sched.current) {
+        vm->sched.current = &vm->sched.main;
+        vm->sched.budget = SCHED_BUDGET;
+    }
+    return vm->sched.current;
+}
+
+// keep the stack of 't', which we are off, for the next spawn
+static void task_release(struct sparrow_vm* vm, struct task* t) {
+    if (vm->sched.n_stacks == vm->sched.cap_stacks) {
+        vm->sched.cap_stacks = vm->sched.cap_stacks ? 2 * vm->sched.cap_stacks : 16;
+        vm->sched.stacks = realloc(vm->sched.stacks, sizeof(char*) * vm->sched.cap_stacks);
+    }
+    vm->sched.stacks[vm->sched.n_stacks++] = t->stack;
+    t->stack = NULL;
+}
+
+static void sched_release(struct sparrow_vm* vm) {
+    if (!vm->sched.finished) return;
+    task_release(vm, vm->sched.finished);
+    vm->sched.finished = NULL;
+}
+
+// take the parked 't' off the receivers of its channel
+static void task_unpark(struct task* t) {
+    struct channel* ch = t->waiting;
+    struct task** p = &ch->receivers;
+    struct task* prev = NULL;
+    while (*p != t) {
+        prev = *p;
+        p = &prev->next;
+    }
+    *p = t->next;
+    if (ch->receivers_tail == t) ch->receivers_tail = prev;
+    t->waiting = NULL;
+}
+
+// nobody can run: wake the main task, with an error if it's parked
+static void sched_deadlock(struct sparrow_vm* vm) {
+    struct task* t = &vm->sched.main;
+    if (t->waiting) {
+        task_unpark(t);
+        t->error = mk_error(vm, mk_str(vm, "deadlock: every task is waiting on a channel"), NULL);
+    }
+    task_push(&vm->sched.ready, &vm->sched.ready_tail, t);
+}
+
+// continue with the next ready task; the current one is already queued,
+// parked on a channel or finished
+static void sched_switch(struct sparrow_vm* vm) {
+    struct task* cur = vm->sched.current;
+    if (!vm->sched.ready) sched_deadlock(vm);
+    struct task* next = task_pop(&vm->sched.ready, &vm->sched.ready_tail);
+    vm->sched.budget = SCHED_BUDGET;
+    if (next == cur) return;
+    cur->frames = vm->frames;
+    cur->handlers = vm->handlers;
+    vm->frames = next->frames;
+    vm->handlers = next->handlers;
+    vm->sched.current = next;
+    swapcontext(&cur->ctx, &next->ctx);
+    sched_release(vm);
+}
+
+static void task_main(unsigned hi, unsigned lo) {
+    struct sparrow_vm* vm = (struct sparrow_vm*)((uintptr_t)hi << 32 | lo);
+    sched_release(vm);
+    struct task* t = vm->sched.current;
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) {
+        fflush(vm->out);
+        fprintf(stderr, "task #%ld: ", t->id);
+        report_error(stderr, vm->raised);
+    } else {
+        apply(vm, t->func, t->args);
+        pop_handler(vm, &h);
+    }
+    t->done = true;
+    vm->sched.finished = t;
+    sched_switch(vm);  // never comes back
+}
+
+struct object* spawn(struct sparrow_vm* vm, struct object* func, struct object* args) {
+    sched_current(vm);
+    vm->sched.spawned = true;
+    struct task* t = malloc(sizeof(struct task));
+    memset(t, 0, sizeof(struct task));
+    t->func = func;
+    t->args = args;
+    t->id = ++vm->sched.n_tasks;
+    t->vm = vm;
+    long page = sysconf(_SC_PAGESIZE);
+    if (vm->sched.n_stacks) {
+        t->stack = vm->sched.stacks[--vm->sched.n_stacks];
+    } else {
+        t->stack = mmap(NULL, TASK_STACK, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (t->stack == MAP_FAILED) raise_error(vm, NULL, "spawn: out of memory for task stacks");
+        mprotect(t->stack, page, PROT_NONE);  // overflows fault instead of corrupting
+    }
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp = t->stack + page;
+    t->ctx.uc_stack.ss_size = TASK_STACK - page;
+    t->ctx.uc_link = NULL;
+    makecontext(&t->ctx, (void (*)(void))task_main, 2,
+                (unsigned)((uintptr_t)vm >> 32), (unsigned)(uintptr_t)vm);
+    task_push(&vm->sched.ready, &vm->sched.ready_tail, t);
+    t->link = vm->sched.tasks;
+    vm->sched.tasks = t;
+    struct object* o = mk_obj(vm, TASK);
+    o->task = t;
+    return o;
+}
+
+// let the ready tasks run before continuing
+void task_yield(struct sparrow_vm* vm) {
+    if (!vm->sched.ready) return;
+    task_push(&vm->sched.ready, &vm->sched.ready_tail, sched_current(vm));
+    sched_switch(vm);
+}
+
+// at the end of a top-level evaluation: the tasks that can run do, until
+// they finish or wait on a channel, and those waiting are discarded. so
+// nothing spawned by one evaluation runs in the middle of the next one
+void sched_drain(struct sparrow_vm* vm) {
+    if (!vm->sched.tasks || vm->sched.current != &vm->sched.main) return;
+    while (vm->sched.ready) task_yield(vm);
+    int discarded = 0;
+    while (vm->sched.tasks) {
+        struct task* t = vm->sched.tasks;
+        vm->sched.tasks = t->link;
+        if (t->done) continue;
+        if (t->waiting) task_unpark(t);
+        task_release(vm, t);
+        t->done = true;
+        discarded++;
+    }
+    if (discarded) {
+        fflush(vm->out);
+        fprintf(stderr, "sparrow: discarded %d task%s waiting on a channel\n", discarded, discarded > 1 ? "s" : "");
+    }
+}
+
+struct object* mk_channel(struct sparrow_vm* vm) {
+    struct object* o = mk_obj(vm, CHANNEL);
+    o->channel = malloc(sizeof(struct channel));
+    memset(o->channel, 0, sizeof(struct channel));
+    return o;
+}
+
+// never blocks: hands 'val' to a parked receiver or queues it
+void channel_send(struct sparrow_vm* vm, struct channel* ch, struct object* val) {
+    struct task* t = task_pop(&ch->receivers, &ch->receivers_tail);
+    if (t) {
+        t->waiting = NULL;
+        t->value = val;
+        task_push(&vm->sched.ready, &vm->sched.ready_tail, t);
+        return;
+    }
+    struct object* cell = cons(vm, val, NULL);
+    if (ch->tail) ch->tail->cdr = cell;
+    else ch->head = cell;
+    ch->tail = cell;
+}
+
+struct object* channel_receive(struct sparrow_vm* vm, struct channel* ch) {
+    if (ch->head) {
+        struct object* val = car(ch->head);
+        if (!(ch->head = cdr(ch->head))) ch->tail = NULL;
+        return val;
+    }
+    struct task* t = sched_current(vm);
+    t->waiting = ch;
+    task_push(&ch->receivers, &ch->receivers_tail, t);
+    sched_switch(vm);
+    if (t->error) {
+        struct object* err = t->error;
+        t->error = NULL;
+        raise_object(vm, err);
+    }
+    return t->value;
+}
+
+/*========================================================
+ * memoization
+ * =======================================================*/
+/*
+ * a memoized procedure keeps the results of its last 'capacity' distinct
+ * argument lists, compared with equal?, in a chained hash table threaded
+ * on a list from the most to the least recently used entry, which is the
+ * one evicted. the lock isn't held while the procedure runs, so it may
+ * call itself, raise or yield; two callers missing on the same arguments
+ * both compute them and the first result is kept.
+ */
+// consistent with is_equal
+static unsigned long equal_hash(struct object* o) {
+    unsigned long h = 0;
+    for (; o && o != g_dummy && o->type == LIST; o = cdr(o)) h = h * 31 + equal_hash(car(o));
+    if (!o || o == g_dummy) return h;
+    switch (o->type) {
+        case NUMBER:
+            return h * 31 + (unsigned long)o->integer * 2654435761UL;
+        case STRING:
+            for (char* c = o->s; *c; c++) h = h * 33 + (unsigned char)*c;
+            return h;
+        default:
+            return h * 31 + prof_hash(o, 0);
+    }
+}
+
+struct object* mk_memoized(struct sparrow_vm* vm, struct object* func, int capacity) {
+    struct object* o = mk_obj(vm, MEMOIZED);
+    o->memo = calloc(1, sizeof(struct memo));
+    o->memo->func = func;
+    o->memo->capacity = capacity;
+    pthread_mutex_init(&o->memo->lock, NULL);
+    return o;
+}
+
+static struct memo_entry** memo_bucket(struct memo* m, unsigned long hash) {
+    return &m->buckets[hash & (m->n_buckets - 1)];
+}
+
+static struct memo_entry* memo_find(struct memo* m, struct object* args, unsigned long hash) {
+    if (!m->buckets) return NULL;
+    for (struct memo_entry* e = *memo_bucket(m, hash); e; e = e->next) {
+        if (e->hash == hash && is_equal(e->args, args)) return e;
+    }
+    return NULL;
+}
+
+static void memo_unlink(struct memo* m, struct memo_entry* e) {
+    if (e->newer) e->newer->older = e->older;
+    else m->newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else m->oldest = e->newer;
+}
+
+static void memo_push(struct memo* m, struct memo_entry* e) {
+    e->newer = NULL;
+    e->older = m->newest;
+    if (m->newest) m->newest->newer = e;
+    else m->oldest = e;
+    m->newest = e;
+}
+
+static void memo_evict(struct memo* m) {
+    struct memo_entry* e = m->oldest;
+    struct memo_entry** p = memo_bucket(m, e->hash);
+    while (*p != e) p = &(*p)->next;
+    *p = e->next;
+    memo_unlink(m, e);
+    free(e);
+    m->count--;
+}
+
+static void memo_insert(struct memo* m, struct object* args, struct object* value, unsigned long hash) {
+    if (m->count == m->capacity) memo_evict(m);
+    if (4 * (m->count + 1) > 3 * m->n_buckets) {  // grow and rehash
+        struct memo_entry** buckets = m->buckets;
+        int n = m->n_buckets;
+        m->n_buckets = n ? 2 * n : 16;
+        m->buckets = calloc(m->n_buckets, sizeof(struct memo_entry*));
+        for (int i = 0; i < n; i++) {
+            for (struct memo_entry *e = buckets[i], *next; e; e = next) {
+                next = e->next;
+                struct memo_entry** b = memo_bucket(m, e->hash);
+                e->next = *b;
+                *b = e;
+            }
+        }
+        free(buckets);
+    }
+    struct memo_entry* e = malloc(sizeof(struct memo_entry));
+    e->args = args;
+    e->value = value;
+    e->hash = hash;
+    struct memo_entry** b = memo_bucket(m, hash);
+    e->next = *b;
+    *b = e;
+    memo_push(m, e);
+    m->count++;
+}
+
+struct object* memo_apply(struct sparrow_vm* vm, struct object* func, struct object* args) {
+    struct memo* m = func->memo;
+    unsigned long hash = equal_hash(args);
+    pthread_mutex_lock(&m->lock);
+    struct memo_entry* e = memo_find(m, args, hash);
+    if (e) {
+        m->hits++;
+        memo_unlink(m, e);
+        memo_push(m, e);
+        struct object* val = e->value;
+        pthread_mutex_unlock(&m->lock);
+        return val;
+    }
+    m->misses++;
+    pthread_mutex_unlock(&m->lock);
+    struct object* val = apply(vm, m->func, args);
+    args = append(vm, args, NULL);  // (apply f l) passes l itself, which may be mutated later
+    pthread_mutex_lock(&m->lock);
+    if ((e = memo_find(m, args, hash))) val = e->value;
+    else memo_insert(m, args, val, hash);
+    pthread_mutex_unlock(&m->lock);
+    return val;
+}
+
+struct object* memo_stats(struct sparrow_vm* vm, struct memo* m) {
+    pthread_mutex_lock(&m->lock);
+    struct object* stats = list(vm, 4,
+            cons(vm, mk_sym(vm, "hits"), mk_integer(vm, m->hits)),
+            cons(vm, mk_sym(vm, "misses"), mk_integer(vm, m->misses)),
+            cons(vm, mk_sym(vm, "size"), mk_integer(vm, m->count)),
+            cons(vm, mk_sym(vm, "capacity"), mk_integer(vm, m->capacity)));
+    pthread_mutex_unlock(&m->lock);
+    return stats;
+}
+
+void memo_clear(struct memo* m) {
+    pthread_mutex_lock(&m->lock);
+    while (m->oldest) memo_evict(m);
+    m->hits = m->misses = 0;
+    pthread_mutex_unlock(&m->lock);
+}
+
+static void memo_free(struct memo* m) {
+    memo_clear(m);
+    free(m->buckets);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
+
 /*========================================================
  * parser
  * =======================================================*/
 int peek(FILE* fp) { return ungetc(getc(fp), fp); }
 bool is_space(int c) { return (c == ' ' || c == '\n' || c == '\r' || c == '\t'); }
-struct object* read_exp(FILE* fp) {
+struct object* read_exp(struct sparrow_vm* vm, FILE* fp) {
     /*
      * (struct object*)(-1): stands for both for 'EOF' and 'end of list'
      * (struct object*)NULL: stands for 'empty list'
      */
-    static char SYMBOLS[] = "~!@#$%^&*_-+\\:,.<>|{}[]?=/";
+    static const char SYMBOLS[] = "~!@#$%^&*_-+\\:,.<>|{}[]?=/";
     int c;
     for (;;) {
         if ((c = getc(fp)) == EOF) return g_dummy;
@@ -767,17 +3157,17 @@ struct object* read_exp(FILE* fp) {
         }
 
         if (c == '"') {  // read string
-            static char buf[256] = {0};
+            char* buf = vm->read_buf;
             int len = 0;
             while ((c = getc(fp)) != EOF) {
                if (c == '"') {
                    buf[len] = '\0';
-                   return mk_str(buf);
+                   return mk_str(vm, buf);
                }
                if (len == 255) {
                    printf("string is too long\n");
                    buf[len++] = '\0';
-                   return mk_str(buf);
+                   return mk_str(vm, buf);
                }
                buf[len++] = c;
             }
@@ -785,8 +3175,8 @@ struct object* read_exp(FILE* fp) {
         }
 
         if (c == '\'') {  // read quote exp
-            struct object* quoted_exp = read_exp(fp);
-            return cons(mk_sym("quote"), cons(quoted_exp, NULL));
+            struct object* quoted_exp = read_exp(vm, fp);
+            return cons(vm, vm->sym.quote, cons(vm, quoted_exp, NULL));
         }
 
         if (isdigit(c) || ((c == '-') && isdigit(peek(fp)))) {  // read number
@@ -795,7 +3185,7 @@ struct object* read_exp(FILE* fp) {
             while (isdigit(peek(fp))) {
                 sum = sum * 10 + (getc(fp) - '0');
             }
-            return mk_integer(sign * sum);
+            return mk_integer(vm, sign * sum);
         }
 
         if (c == '(' && peek(fp) == ')') {  // read empty list
@@ -804,11 +3194,13 @@ struct object* read_exp(FILE* fp) {
         if (c == '(') {  // read list
             struct object* l = NULL;
             while (true) {
-                struct object* o = read_exp(fp);
+                struct object* o = read_exp(vm, fp);
                 if (o == g_dummy) break;
-                l = cons(o, l);
+                l = cons(vm, o, l);
             }
-            return reverse(l);
+            l = reverse(vm, l);
+            for (struct object* p = l; p; p = cdr(p)) p->source = true;
+            return l;
         }
         if (c == ')') {return g_dummy;  /*end of list*/}
 
@@ -817,50 +3209,54 @@ struct object* read_exp(FILE* fp) {
             buf[0] = c;
             int i = 1;
             while (isalnum(peek(fp)) || strchr(SYMBOLS, peek(fp))) {
-                if (i >= 128) printf("Symbol name too long - max length 128 characters");
+                if (i == 127) {
+                    printf("Symbol name too long - max length 128 characters");
+                    getc(fp);
+                    continue;
+                }
                 buf[i++] = getc(fp);
             }
             buf[i] = '\0';
             if (i == 2 && buf[0] == '#' && ((buf[1] == 't') || (buf[1] == 'f')))
-                return buf[1] == 't' ? g_true : g_false;
-            return mk_sym(buf);
+                return buf[1] == 't' ? vm->true_obj : vm->false_obj;
+            return mk_sym(vm, buf);
         }
     }
 }
 
-void print(struct object* o) {
+void fprint(FILE* out, struct object* o) {
     if (!o) {
-        printf("()");
+        fprintf(out, "()");
     } else {
         if (o == g_dummy) {
             return ;
         }
         switch (o->type) {
             case BOOLEAN:
-                printf("%s", o->b ? "#t" : "#f");
+                fprintf(out, "%s", o->b ? "#t" : "#f");
                 break;
             case NUMBER:
-                printf("%ld", o->integer);
+                fprintf(out, "%ld", o->integer);
                 break;
             case SYMBOL:
-                printf("%s", o->s);
+                fprintf(out, "%s", o->s);
                 break;
             case STRING:
-                printf("\"%s\"", o->s);
+                fprintf(out, "\"%s\"", o->s);
                 break;
             case PORT:
-                printf("<PORT>");
+                fprintf(out, "<PORT>");
                 break;
             case LIST:
                 {
-                    printf("(");
+                    fprintf(out, "(");
                     while (o) {
-                        print(car(o));
+                        fprint(out, car(o));
                         if (cdr(o)) {
-                            printf(" ");
+                            fprintf(out, " ");
                             if (cdr(o)->type != LIST) {
-                                printf(". ");
-                                print(cdr(o));
+                                fprintf(out, ". ");
+                                fprint(out, cdr(o));
                                 break;
                             } else {
                                 o = cdr(o);
@@ -869,131 +3265,620 @@ void print(struct object* o) {
                             break;
                         }
                     }
-                    printf(")");
+                    fprintf(out, ")");
                 }
                 break;
             case PRIMITIVE:
-                printf("<BUILTIN-PRIMITIVE>#%s", o->prim_name->s);
+                fprintf(out, "<BUILTIN-PRIMITIVE>#%s", o->prim_name->s);
                 break;
             case PROCEDURE:
-                printf("<COMPOUND-PROCEDURE>#%s", o->name->s);
+                fprintf(out, "<COMPOUND-PROCEDURE>#%s", o->name->s);
                 break;
             case ENVIRONMENT:
-                printf("----start of environment-------\n");
+                fprintf(out, "----start of environment-------\n");
                 while (o) {
                     struct object* frame = o->frame;
                     struct object* vars = car(frame);
                     struct object* vals = cdr(frame);
                     while (vars) {
-                        print(car(vars));
-                        printf(" : ");
-                        print(car(vals));
-                        printf("\n");
+                        fprint(out, car(vars));
+                        fprintf(out, " : ");
+                        fprint(out, car(vals));
+                        fprintf(out, "\n");
                         vars = cdr(vars);
                         vals = cdr(vals);
                     }
                     o = o->parent;
                     if (o) {
-                        printf("----parent------>\n");
+                        fprintf(out, "----parent------>\n");
                     } else {
-                        printf("----end of environment------\n");
+                        fprintf(out, "----end of environment------\n");
                     }
                 }
                 break;
             case SYNTAX:
-                printf("SPECIAL-FORM");
+                fprintf(out, "SPECIAL-FORM");
+                break;
+            case TASK:
+                fprintf(out, "<TASK>#%ld", o->task->id);
+                break;
+            case CHANNEL:
+                fprintf(out, "<CHANNEL>");
+                break;
+            case ERROR:
+                fprintf(out, "<ERROR>#");
+                fprint_error(out, o);
+                break;
+            case PROMISE:
+                fprintf(out, "<PROMISE>");
+                break;
+            case MACRO:
+                fprintf(out, "<MACRO>");
+                break;
+            case MEMOIZED:
+                fprintf(out, "<MEMOIZED>#");
+                fprint(out, o->memo->func->type == PROCEDURE ? o->memo->func->name
+                        : o->memo->func->type == PRIMITIVE ? o->memo->func->prim_name : o->memo->func);
                 break;
             default:
-                printf("DEFAULT");
+                fprintf(out, "DEFAULT");
                 break;
         }
     }
 }
 
+void print(struct object* o) {
+    fprint(stdout, o);
+}
+
 /*========================================================
  * initialization
  * =======================================================*/
-static void sparrow_init() {
+struct sparrow_vm* sparrow_create() {
+    struct sparrow_vm* vm = malloc(sizeof(struct sparrow_vm));
+    memset(vm, 0, sizeof(struct sparrow_vm));
+    vm->out = stdout;
+    pthread_mutex_init(&vm->promise_lock, NULL);
+    pthread_cond_init(&vm->promise_forced, NULL);
+
     // init symbol table
     {
-        g_sym_table.size = 10009;
-        g_sym_table.table = malloc(sizeof(struct object*) * g_sym_table.size);
-        memset(g_sym_table.table, 0, sizeof(struct object*) * g_sym_table.size);
+        vm->sym_table.size = 10009;
+        vm->sym_table.table = malloc(sizeof(struct object*) * vm->sym_table.size);
+        memset(vm->sym_table.table, 0, sizeof(struct object*) * vm->sym_table.size);
     }
 
-    // init the_global_environment
+    // init vm->global_env
     {
-        the_global_environment = mk_env(NULL);
-        g_true = mk_bool(true);
-        g_false = mk_bool(false);  // everything not false is true.
-        define_variable(mk_sym("#t"), g_true, the_global_environment);
-        define_variable(mk_sym("#f"), g_false, the_global_environment);
-        define_variable(mk_sym("()"), NULL, the_global_environment);
-        define_variable(mk_sym("nil"), NULL, the_global_environment);
+        vm->global_env = vm->top_env = mk_env(vm, NULL);
+        vm->true_obj = mk_bool(vm, true);
+        vm->false_obj = mk_bool(vm, false);  // everything not false is true.
+        vm->eof_obj = mk_port(vm, NULL);
+        vm->sym.dot = mk_sym(vm, ".");
+        vm->sym.begin = mk_sym(vm, "begin");
+        vm->sym.lambda = mk_sym(vm, "lambda");
+        vm->sym.quote = mk_sym(vm, "quote");
+        vm->sym.define = mk_sym(vm, "define");
+        vm->sym.let = mk_sym(vm, "let");
+        vm->sym.delay = mk_sym(vm, "delay");
+        vm->sym.cons_stream = mk_sym(vm, "cons-stream");
+        vm->sym.define_memoized = mk_sym(vm, "define-memoized");
+        vm->sym.ellipsis = mk_sym(vm, "...");
+        vm->sym.underscore = mk_sym(vm, "_");
+        vm->sym.capacity = mk_sym(vm, "#:capacity");
+        define_variable(vm, mk_sym(vm, "#t"), vm->true_obj, vm->global_env);
+        define_variable(vm, mk_sym(vm, "#f"), vm->false_obj, vm->global_env);
+        define_variable(vm, mk_sym(vm, "()"), NULL, vm->global_env);
+        define_variable(vm, mk_sym(vm, "nil"), NULL, vm->global_env);
 
         // primitives
-        define_variable(mk_sym("cons"), mk_prim("cons", prim_cons), the_global_environment);
-        define_variable(mk_sym("car"), mk_prim("car", prim_car), the_global_environment);
-        define_variable(mk_sym("cdr"), mk_prim("cdr", prim_cdr), the_global_environment);
-        define_variable(mk_sym("equal?"), mk_prim("equal?", prim_eq), the_global_environment);
-        define_variable(mk_sym("pair?"), mk_prim("pair?", prim_is_pair), the_global_environment);
-        define_variable(mk_sym("symbol?"), mk_prim("symbol?", prim_is_symbol), the_global_environment);
-        define_variable(mk_sym("number?"), mk_prim("number?", prim_is_number), the_global_environment);
-        define_variable(mk_sym("string?"), mk_prim("string?", prim_is_string), the_global_environment);
-        define_variable(mk_sym("null?"), mk_prim("null?", prim_isnull), the_global_environment);
-        define_variable(mk_sym("not"), mk_prim("not", prim_not), the_global_environment);
-        define_variable(mk_sym("+"), mk_prim("+", prim_add), the_global_environment);
-        define_variable(mk_sym("*"), mk_prim("*", prim_multiply), the_global_environment);
-        define_variable(mk_sym("-"), mk_prim("-", prim_subtract), the_global_environment);
-        define_variable(mk_sym("/"), mk_prim("/", prim_divide), the_global_environment);
-        define_variable(mk_sym("mod"), mk_prim("mod", prim_mod), the_global_environment);
-        define_variable(mk_sym("="), mk_prim("=", prim_num_eq), the_global_environment);
-        define_variable(mk_sym("<"), mk_prim("<", prim_num_lt), the_global_environment);
-        define_variable(mk_sym("load"), mk_prim("load", load), the_global_environment);
-        define_variable(mk_sym("display"), mk_prim("display", prim_display), the_global_environment);
-        define_variable(mk_sym("newline"), mk_prim("newline", prim_newline), the_global_environment);
-        define_variable(mk_sym("eval"), mk_prim("eval", prim_eval), the_global_environment);
-        define_variable(mk_sym("error"), mk_prim("error", prim_error), the_global_environment);
-        define_variable(mk_sym("read"), mk_prim("read", prim_read), the_global_environment);
-        define_variable(mk_sym("environ"), mk_prim("environ", prim_environ), the_global_environment);
-        define_variable(mk_sym("length"), mk_prim("length", prim_length), the_global_environment);
-        define_variable(mk_sym("apply"), mk_prim("apply", prim_apply), the_global_environment);
+        define_variable(vm, mk_sym(vm, "cons"), mk_prim(vm, "cons", prim_cons), vm->global_env);
+        define_variable(vm, mk_sym(vm, "car"), mk_prim(vm, "car", prim_car), vm->global_env);
+        define_variable(vm, mk_sym(vm, "cdr"), mk_prim(vm, "cdr", prim_cdr), vm->global_env);
+        define_variable(vm, mk_sym(vm, "equal?"), mk_prim(vm, "equal?", prim_eq), vm->global_env);
+        define_variable(vm, mk_sym(vm, "pair?"), mk_prim(vm, "pair?", prim_is_pair), vm->global_env);
+        define_variable(vm, mk_sym(vm, "symbol?"), mk_prim(vm, "symbol?", prim_is_symbol), vm->global_env);
+        define_variable(vm, mk_sym(vm, "number?"), mk_prim(vm, "number?", prim_is_number), vm->global_env);
+        define_variable(vm, mk_sym(vm, "string?"), mk_prim(vm, "string?", prim_is_string), vm->global_env);
+        define_variable(vm, mk_sym(vm, "null?"), mk_prim(vm, "null?", prim_isnull), vm->global_env);
+        define_variable(vm, mk_sym(vm, "not"), mk_prim(vm, "not", prim_not), vm->global_env);
+        define_variable(vm, mk_sym(vm, "+"), mk_prim(vm, "+", prim_add), vm->global_env);
+        define_variable(vm, mk_sym(vm, "*"), mk_prim(vm, "*", prim_multiply), vm->global_env);
+        define_variable(vm, mk_sym(vm, "-"), mk_prim(vm, "-", prim_subtract), vm->global_env);
+        define_variable(vm, mk_sym(vm, "/"), mk_prim(vm, "/", prim_divide), vm->global_env);
+        define_variable(vm, mk_sym(vm, "mod"), mk_prim(vm, "mod", prim_mod), vm->global_env);
+        define_variable(vm, mk_sym(vm, "="), mk_prim(vm, "=", prim_num_eq), vm->global_env);
+        define_variable(vm, mk_sym(vm, "<"), mk_prim(vm, "<", prim_num_lt), vm->global_env);
+        define_variable(vm, mk_sym(vm, "load"), mk_prim(vm, "load", prim_load), vm->global_env);
+        define_variable(vm, mk_sym(vm, "display"), mk_prim(vm, "display", prim_display), vm->global_env);
+        define_variable(vm, mk_sym(vm, "newline"), mk_prim(vm, "newline", prim_newline), vm->global_env);
+        define_variable(vm, mk_sym(vm, "eval"), mk_prim(vm, "eval", prim_eval), vm->global_env);
+        define_variable(vm, mk_sym(vm, "error"), mk_prim(vm, "error", prim_error), vm->global_env);
+        define_variable(vm, mk_sym(vm, "force"), mk_prim(vm, "force", prim_force), vm->global_env);
+        define_variable(vm, mk_sym(vm, "promise?"), mk_prim(vm, "promise?", prim_is_promise), vm->global_env);
+        define_variable(vm, mk_sym(vm, "memoize"), mk_prim(vm, "memoize", prim_memoize), vm->global_env);
+        define_variable(vm, mk_sym(vm, "memo-stats"), mk_prim(vm, "memo-stats", prim_memo_stats), vm->global_env);
+        define_variable(vm, mk_sym(vm, "memo-clear!"), mk_prim(vm, "memo-clear!", prim_memo_clear), vm->global_env);
+        define_variable(vm, mk_sym(vm, "gensym"), mk_prim(vm, "gensym", prim_gensym), vm->global_env);
+        define_variable(vm, mk_sym(vm, "macroexpand"), mk_prim(vm, "macroexpand", prim_macroexpand), vm->global_env);
+        define_variable(vm, mk_sym(vm, "raise"), mk_prim(vm, "raise", prim_raise), vm->global_env);
+        define_variable(vm, mk_sym(vm, "with-exception-handler"), mk_prim(vm, "with-exception-handler", prim_with_exception_handler), vm->global_env);
+        define_variable(vm, mk_sym(vm, "error-object?"), mk_prim(vm, "error-object?", prim_is_error_object), vm->global_env);
+        define_variable(vm, mk_sym(vm, "error-object-message"), mk_prim(vm, "error-object-message", prim_error_object_message), vm->global_env);
+        define_variable(vm, mk_sym(vm, "error-object-irritants"), mk_prim(vm, "error-object-irritants", prim_error_object_irritants), vm->global_env);
+        define_variable(vm, mk_sym(vm, "read"), mk_prim(vm, "read", prim_read), vm->global_env);
+        define_variable(vm, mk_sym(vm, "open-input-file"), mk_prim(vm, "open-input-file", prim_open_input_file), vm->global_env);
+        define_variable(vm, mk_sym(vm, "close-port"), mk_prim(vm, "close-port", prim_close_port), vm->global_env);
+        define_variable(vm, mk_sym(vm, "eof-object?"), mk_prim(vm, "eof-object?", prim_is_eof_object), vm->global_env);
+        define_variable(vm, mk_sym(vm, "environ"), mk_prim(vm, "environ", prim_environ), vm->global_env);
+        define_variable(vm, mk_sym(vm, "length"), mk_prim(vm, "length", prim_length), vm->global_env);
+        define_variable(vm, mk_sym(vm, "apply"), mk_prim(vm, "apply", prim_apply), vm->global_env);
+        define_variable(vm, mk_sym(vm, "parallel-map"), mk_prim(vm, "parallel-map", prim_parallel_map), vm->global_env);
+        define_variable(vm, mk_sym(vm, "parallel-for-each"), mk_prim(vm, "parallel-for-each", prim_parallel_for_each), vm->global_env);
+        define_variable(vm, mk_sym(vm, "runtime"), mk_prim(vm, "runtime", prim_runtime), vm->global_env);
+        define_variable(vm, mk_sym(vm, "current-time-ns"), mk_prim(vm, "current-time-ns", prim_current_time_ns), vm->global_env);
+        define_variable(vm, mk_sym(vm, "heap-stats"), mk_prim(vm, "heap-stats", prim_heap_stats), vm->global_env);
+        define_variable(vm, mk_sym(vm, "profile-start"), mk_prim(vm, "profile-start", prim_profile_start), vm->global_env);
+        define_variable(vm, mk_sym(vm, "profile-stop"), mk_prim(vm, "profile-stop", prim_profile_stop), vm->global_env);
+        define_variable(vm, mk_sym(vm, "spawn"), mk_prim(vm, "spawn", prim_spawn), vm->global_env);
+        define_variable(vm, mk_sym(vm, "yield"), mk_prim(vm, "yield", prim_yield), vm->global_env);
+        define_variable(vm, mk_sym(vm, "make-channel"), mk_prim(vm, "make-channel", prim_make_channel), vm->global_env);
+        define_variable(vm, mk_sym(vm, "send"), mk_prim(vm, "send", prim_send), vm->global_env);
+        define_variable(vm, mk_sym(vm, "receive"), mk_prim(vm, "receive", prim_receive), vm->global_env);
 
         // special forms
-        define_variable(mk_sym("quote"), mk_syntax(syntax_quote), the_global_environment);
-        define_variable(mk_sym("if"), mk_syntax(syntax_if), the_global_environment);
-        define_variable(mk_sym("define"), mk_syntax(syntax_define), the_global_environment);
-        define_variable(mk_sym("lambda"), mk_syntax(syntax_lambda), the_global_environment);
-        define_variable(mk_sym("cond"), mk_syntax(syntax_cond), the_global_environment);
-        define_variable(mk_sym("begin"), mk_syntax(syntax_begin), the_global_environment);
-        define_variable(mk_sym("let"), mk_syntax(syntax_let), the_global_environment);
-        define_variable(mk_sym("set!"), mk_syntax(syntax_set), the_global_environment);
-        define_variable(mk_sym("set-car!"), mk_syntax(syntax_set_car), the_global_environment);
-        define_variable(mk_sym("set-cdr!"), mk_syntax(syntax_set_cdr), the_global_environment);
-    }
-    return ;
-}
-
-int main() {
-    sparrow_init();
-    load(mk_str("./res/lib.scm"));
-#ifdef META_EVAL
-    printf("run SICP's mceval.scm on sparrow.\n");
-    load(mk_str("./res/mceval.scm"));
+        define_variable(vm, mk_sym(vm, "quote"), mk_syntax(vm, syntax_quote), vm->global_env);
+        define_variable(vm, mk_sym(vm, "if"), mk_syntax(vm, syntax_if), vm->global_env);
+        define_variable(vm, mk_sym(vm, "define"), mk_syntax(vm, syntax_define), vm->global_env);
+        define_variable(vm, mk_sym(vm, "lambda"), mk_syntax(vm, syntax_lambda), vm->global_env);
+        define_variable(vm, mk_sym(vm, "cond"), mk_syntax(vm, syntax_cond), vm->global_env);
+        define_variable(vm, mk_sym(vm, "begin"), mk_syntax(vm, syntax_begin), vm->global_env);
+        define_variable(vm, mk_sym(vm, "let"), mk_syntax(vm, syntax_let), vm->global_env);
+        define_variable(vm, mk_sym(vm, "let*"), mk_syntax(vm, syntax_let_star), vm->global_env);
+        define_variable(vm, mk_sym(vm, "letrec"), mk_syntax(vm, syntax_letrec), vm->global_env);
+        define_variable(vm, mk_sym(vm, "do"), mk_syntax(vm, syntax_do), vm->global_env);
+        define_variable(vm, mk_sym(vm, "set!"), mk_syntax(vm, syntax_set), vm->global_env);
+        define_variable(vm, mk_sym(vm, "set-car!"), mk_syntax(vm, syntax_set_car), vm->global_env);
+        define_variable(vm, mk_sym(vm, "set-cdr!"), mk_syntax(vm, syntax_set_cdr), vm->global_env);
+        define_variable(vm, mk_sym(vm, "guard"), mk_syntax(vm, syntax_guard), vm->global_env);
+        define_variable(vm, mk_sym(vm, "delay"), mk_syntax(vm, syntax_delay), vm->global_env);
+        define_variable(vm, mk_sym(vm, "define-memoized"), mk_syntax(vm, syntax_define_memoized), vm->global_env);
+        define_variable(vm, mk_sym(vm, "define-macro"), mk_syntax(vm, syntax_define_macro), vm->global_env);
+        define_variable(vm, mk_sym(vm, "define-syntax"), mk_syntax(vm, syntax_define_syntax), vm->global_env);
+        define_variable(vm, mk_sym(vm, "syntax-rules"), mk_syntax(vm, syntax_syntax_rules), vm->global_env);
+        define_variable(vm, mk_sym(vm, "cons-stream"), mk_syntax(vm, syntax_cons_stream), vm->global_env);
+    }
+    return vm;
+}
+
+int sparrow_load(struct sparrow_vm* vm, const char* filename) {
+    vm->error = NULL;
+    FILE* fp = fopen(filename, "r");
+    if (!fp) return -1;
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) {
+        vm->error = vm->raised;
+        fclose(fp);
+        sched_drain(vm);
+        return -1;
+    }
+    load_stream(vm, fp, vm->global_env, NULL);
+    pop_handler(vm, &h);
+    fclose(fp);
+    sched_drain(vm);
     return 0;
-#elif DEBUG
-    struct object* module = mk_str("./res/test.scm");
-    load(module);
+}
+
+struct object* sparrow_eval(struct sparrow_vm* vm, const char* source) {
+    vm->error = NULL;
+    FILE* fp = fmemopen((void*)source, strlen(source), "r");
+    if (!fp) return NULL;
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) {
+        vm->error = vm->raised;
+        fclose(fp);
+        sched_drain(vm);
+        return NULL;
+    }
+    struct object* val = load_stream(vm, fp, vm->global_env, NULL);
+    pop_handler(vm, &h);
+    fclose(fp);
+    sched_drain(vm);
+    return val;
+}
+
+struct object* sparrow_error(struct sparrow_vm* vm) {
+    return vm->error;
+}
+
+void sparrow_print(struct sparrow_vm* vm, struct object* o, FILE* out) {
+    fprint(out, o);
+}
+
+static void free_chunks(struct chunk* c) {
+    while (c) {
+        for (int i = 0; i < c->used; i++) {
+            struct object* o = &c->objects[i];
+            if (o->type == STRING || o->type == SYMBOL) free(o->s);
+            if (o->type == CHANNEL) free(o->channel);
+            if (o->type == MEMOIZED) memo_free(o->memo);
+            if (o->type == TASK) {
+                if (o->task->stack) munmap(o->task->stack, TASK_STACK);
+                free(o->task);
+            }
+        }
+        struct chunk* next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+void sparrow_destroy(struct sparrow_vm* vm) {
+    if (vm->prof.active) prof_stop(vm, stderr, NULL);
+    if (vm->pool) {
+        pool_destroy(vm->pool);
+        pthread_mutex_destroy(&vm->sym_lock);
+    }
+    pthread_mutex_destroy(&vm->promise_lock);
+    pthread_cond_destroy(&vm->promise_forced);
+    free_chunks(vm->chunks);
+    for (int i = 0; i < vm->sched.n_stacks; i++) munmap(vm->sched.stacks[i], TASK_STACK);
+    free(vm->sched.stacks);
+    free(vm->forms.keys);
+    free(vm->forms.values);
+    free(vm->deps.keys);
+    free(vm->deps.values);
+    free(vm->expansions.keys);
+    free(vm->expansions.values);
+    free(vm->sym_table.table);
+    free(vm->prof.procs);
+    free(vm->prof.nodes);
+    free(vm->prof.index);
+    free(vm);
+}
+
+/*========================================================
+ * server
+ * =======================================================*/
+/*
+ * --serve keeps one warm vm and evaluates requests of unix socket clients.
+ * a request is a 4 byte big-endian length followed by that much scheme
+ * source, whose expressions are evaluated in a fresh child environment of
+ * the global one, like the files it loads and what it evals. it can't
+ * change a global, and its tasks are drained before it is answered. the
+ * response is a 4 byte big-endian length followed by a status byte, then
+ * the output of the request and either its value (status 0) or the error
+ * it raised (status 1).
+ *
+ * with workers, the warmed up process forks them after loading: they share
+ * its heap copy-on-write and the listening socket, whose accept queue hands
+ * each connection to one idle worker. a worker that dies is replaced by a
+ * fresh fork of the parent.
+ */
+#define SERVE_MAX_CLIENTS 256
+#define SERVE_MAX_REQUEST (16 << 20)
+#define SERVE_MAX_DELAY 5000  // ms between attempts to fork a worker
+struct client {
+    int fd;
+    char* buf;
+    size_t len, cap;
+};
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig) {
+    serve_stop = 1;
+}
+
+static bool write_all(int fd, const char* p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EAGAIN) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+        } else if (w < 0 && errno != EINTR) {
+            return false;
+        } else if (w > 0) {
+            p += w;
+            n -= w;
+        }
+    }
+    return true;
+}
+
+// evaluate one request into a response payload
+static char* serve_eval(struct sparrow_vm* vm, char* src, size_t len, size_t* size) {
+    char* payload = NULL;
+    FILE* out = vm->out;
+    vm->out = open_memstream(&payload, size);
+    fputc(0, vm->out);  // status
+    FILE* fp = len ? fmemopen(src, len, "r") : NULL;
+    vm->top_env = mk_env(vm, vm->global_env);
+    struct handler h;
+    push_handler(vm, &h);
+    if (setjmp(h.jmp)) {
+        fflush(vm->out);
+        payload[0] = 1;
+        report_error(vm->out, vm->raised);
+    } else {
+        struct object* val = fp ? load_stream(vm, fp, vm->top_env, NULL) : NULL;
+        sched_drain(vm);  // its tasks write to its output
+        fprint(vm->out, val);
+        pop_handler(vm, &h);
+    }
+    sched_drain(vm);
+    vm->top_env = vm->global_env;
+    if (fp) fclose(fp);
+    fclose(vm->out);
+    vm->out = out;
+    return payload;
+}
+
+// answer every complete request in the client's buffer, false to drop it
+static bool serve_client(struct sparrow_vm* vm, struct client* c) {
+    while (c->len >= 4) {
+        unsigned char* h = (unsigned char*)c->buf;
+        size_t n = (size_t)h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3];
+        if (n > SERVE_MAX_REQUEST) return false;
+        if (c->len < 4 + n) return true;
+        size_t size;
+        char* payload = serve_eval(vm, c->buf + 4, n, &size);
+        unsigned char header[4] = {size >> 24, size >> 16, size >> 8, size};
+        bool ok = write_all(c->fd, (char*)header, 4) && write_all(c->fd, payload, size);
+        free(payload);
+        if (!ok) return false;
+        memmove(c->buf, c->buf + 4 + n, c->len - 4 - n);
+        c->len -= 4 + n;
+    }
+    return true;
+}
+
+int serve_listen(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+// serve the clients of 'listen_fd' until SIGINT/SIGTERM, or until the
+// 'recycle' connections accepted (0: no limit) are done
+void serve_loop(struct sparrow_vm* vm, int listen_fd, int recycle) {
+    struct pollfd fds[SERVE_MAX_CLIENTS + 1];
+    struct client clients[SERVE_MAX_CLIENTS];
+    int n = 0, accepted = 0;
+    while (!serve_stop) {
+        bool accepting = !recycle || accepted < recycle;
+        if (!accepting && n == 0) break;
+        fds[0] = (struct pollfd){listen_fd, accepting && n < SERVE_MAX_CLIENTS ? POLLIN : 0, 0};
+        for (int i = 0; i < n; i++) fds[i + 1] = (struct pollfd){clients[i].fd, POLLIN, 0};
+        if (poll(fds, n + 1, -1) < 0) continue;
+        for (int i = n - 1; i >= 0; i--) {
+            if (!fds[i + 1].revents) continue;
+            struct client* c = &clients[i];
+            if (c->cap - c->len < 4096) {
+                c->cap = c->cap ? 2 * c->cap : 8192;
+                c->buf = realloc(c->buf, c->cap);
+            }
+            ssize_t r = read(c->fd, c->buf + c->len, c->cap - c->len);
+            if (r < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            if (r > 0) c->len += r;
+            if (r <= 0 || !serve_client(vm, c)) {
+                close(c->fd);
+                free(c->buf);
+                clients[i] = clients[--n];
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) continue;  // another worker was faster
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            clients[n++] = (struct client){fd, NULL, 0, 0};
+            accepted++;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        close(clients[i].fd);
+        free(clients[i].buf);
+    }
+}
+
+// -1 if fork failed
+static pid_t serve_fork(struct sparrow_vm* vm, int listen_fd, int recycle) {
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) fprintf(stderr, "sparrow: fork: %s\n", strerror(errno));
+    if (pid == 0) {
+        vm->pool = NULL;  // its threads were not forked, start over on demand
+        serve_loop(vm, listen_fd, recycle);
+        fflush(NULL);
+        _exit(0);
+    }
+    return pid;
+}
+
+// fork 'n' workers and replace the ones that exit until SIGINT/SIGTERM.
+// failed forks are retried, waiting longer and longer while they fail
+static void serve_workers(struct sparrow_vm* vm, int listen_fd, int n, int recycle) {
+    pid_t* pids = malloc(sizeof(pid_t) * n);
+    for (int i = 0; i < n; i++) pids[i] = -1;
+    int delay = 0;  // ms
+    while (!serve_stop) {
+        bool missing = false;
+        for (int i = 0; i < n; i++) {
+            if (pids[i] < 0 && (pids[i] = serve_fork(vm, listen_fd, recycle)) < 0) missing = true;
+        }
+        delay = !missing ? 0 : delay ? (delay < SERVE_MAX_DELAY / 2 ? 2 * delay : SERVE_MAX_DELAY) : 10;
+        if (missing) poll(NULL, 0, delay);
+        int status;
+        pid_t pid = waitpid(-1, &status, missing ? WNOHANG : 0);
+        if (pid == 0 || (pid < 0 && errno == EINTR)) continue;
+        if (pid < 0 && errno == ECHILD && missing) continue;  // no worker could be forked yet
+        if (pid < 0) {
+            fprintf(stderr, "sparrow: waitpid: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (pids[i] != pid) continue;
+            if (WIFSIGNALED(status)) {
+                fprintf(stderr, "sparrow: worker %d killed by signal %d, respawning\n", pid, WTERMSIG(status));
+            }
+            pids[i] = -1;  // forked again at the top of the loop
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (pids[i] > 0) kill(pids[i], SIGTERM);
+    }
+    for (int i = 0; i < n; i++) {
+        if (pids[i] > 0) waitpid(pids[i], NULL, 0);
+    }
+    free(pids);
+}
+
+int sparrow_serve(struct sparrow_vm* vm, const char* path, int workers, int recycle) {
+    int fd = serve_listen(path);
+    if (fd < 0) return -1;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_signal;  // no SA_RESTART: interrupt poll and waitpid
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if (workers > 0) {
+        serve_workers(vm, fd, workers, recycle);
+    } else {
+        serve_loop(vm, fd, recycle);
+    }
+    close(fd);
+    unlink(path);
     return 0;
-#endif
-    printf("Welcome to *SPARROW* LISP.\n");
-    while (true) {
-        printf("> ");
-        print(eval(read_exp(stdin), the_global_environment));
-        newline();
-        if (peek(stdin) == EOF) {
-            printf("Moriturus te salutat.\n"); break;
+}
+
+#ifndef SPARROW_NO_MAIN
+// load 'files', going on after errors; returns how many there were.
+// with 'bench', report wall time, allocations and peak rss of loading them
+int load_files(struct sparrow_vm* vm, char* files[], int n, bool bench) {
+    int64_t start = now_ns(CLOCK_MONOTONIC);
+    long objects = heap_total(vm->heap.objects), bytes = heap_total(vm->heap.bytes);
+    int errors = 0;
+    for (int i = 0; i < n; i++) {
+        FILE* fp = fopen(files[i], "r");
+        if (!fp) {
+            fprintf(stderr, "%s: %s\n", files[i], strerror(errno));
+            errors++;
+            continue;
         }
+        load_stream(vm, fp, vm->global_env, &errors);
+        fclose(fp);
+        sched_drain(vm);
     }
+    if (bench) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        fflush(stdout);
+        fprintf(stderr, "bench\t%ld\t%ld\t%ld\t%ld\n", (long)(now_ns(CLOCK_MONOTONIC) - start),
+                heap_total(vm->heap.objects) - objects, heap_total(vm->heap.bytes) - bytes, usage.ru_maxrss);
+    }
+    return errors;
 }
 
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--profile[=FILE]] [--heap-stats] [--bench]\n", prog);
+    fprintf(stderr, "       [--serve SOCKET [--workers N] [--recycle M]] [file ...]\n");
+    fprintf(stderr, "  --profile[=FILE]  sample the run, report per-procedure times on exit\n");
+    fprintf(stderr, "                    and write flamegraph 'folded' stacks to FILE\n");
+    fprintf(stderr, "  --heap-stats      print allocation counters on exit\n");
+    fprintf(stderr, "  --bench           print 'bench <wall-ns> <objects> <bytes> <maxrss-kb>'\n");
+    fprintf(stderr, "                    for the given files on exit (see bench/run.sh)\n");
+    fprintf(stderr, "  --serve SOCKET    load the files, then evaluate requests sent to the\n");
+    fprintf(stderr, "                    unix socket SOCKET (see README.md)\n");
+    fprintf(stderr, "  --workers N       serve from N forked worker processes\n");
+    fprintf(stderr, "  --recycle M       replace a worker after M connections, 1 gives\n");
+    fprintf(stderr, "                    every connection a fresh copy of the loaded heap\n");
+}
+
+int main(int argc, char* argv[]) {
+    bool profile = false, stats = false, bench = false;
+    const char* folded = NULL;
+    const char* serve = NULL;
+    int status = 0, workers = 0, recycle = 0;
+    static struct option options[] = {
+        {"profile", optional_argument, NULL, 'p'},
+        {"heap-stats", no_argument, NULL, 's'},
+        {"bench", no_argument, NULL, 'b'},
+        {"serve", required_argument, NULL, 'S'},
+        {"workers", required_argument, NULL, 'w'},
+        {"recycle", required_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'p': profile = true; folded = optarg; break;
+            case 's': stats = true; break;
+            case 'b': bench = true; break;
+            case 'S': serve = optarg; break;
+            case 'w': workers = atoi(optarg); break;
+            case 'r': recycle = atoi(optarg); break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    struct sparrow_vm* vm = sparrow_create();
+    sparrow_load(vm, "./res/lib.scm");
+    if (profile) prof_start(vm);
+#ifdef META_EVAL
+    printf("run SICP's mceval.scm on sparrow.\n");
+    status = load_files(vm, (char*[]){"./res/mceval.scm"}, 1, bench) ? 1 : 0;
+    struct object* val;
+    if (!try_eval(vm, list(vm, 1, mk_sym(vm, "driver-loop")), vm->global_env, &val)) {
+        report_error(stderr, vm->raised);
+        status = 1;
+    }
+    sched_drain(vm);
+#elif DEBUG
+    status = load_files(vm, (char*[]){"./res/test.scm"}, 1, bench) ? 1 : 0;
+#else
+    if (optind < argc) {
+        status = load_files(vm, argv + optind, argc - optind, bench) ? 1 : 0;
+    } else if (!serve) {
+        printf("Welcome to *SPARROW* LISP.\n");
+        while (true) {
+            printf("> ");
+            struct object* val;
+            if (try_eval(vm, read_exp(vm, stdin), vm->global_env, &val)) {
+                fprint(vm->out, val);
+                newline();
+            } else {
+                report_error(vm->out, vm->raised);
+            }
+            sched_drain(vm);
+            if (peek(stdin) == EOF) {
+                printf("Moriturus te salutat.\n"); break;
+            }
+        }
+    }
+#endif
+    if (serve && sparrow_serve(vm, serve, workers, recycle) < 0) {
+        perror(serve);
+        status = 1;
+    }
+    fflush(stdout);
+    if (profile) prof_stop(vm, stderr, folded);
+    if (stats) print_heap_stats(vm, stderr);
+    sparrow_destroy(vm);
+    return status;
+}
+#endif
@@ -0,0 +1,43 @@
+/*
+ * embedding api of sparrow.
+ *
+ * every sparrow_vm is an independent interpreter with its own heap, symbol
+ * table and global environment: different vms can be used from different
+ * threads at the same time, a single vm must not.
+ */
+#ifndef SPARROW_H
+#define SPARROW_H
+
+#include <stdio.h>
+
+typedef struct sparrow_vm sparrow_vm;
+struct object;
+
+// a fresh interpreter with the builtins defined; load res/lib.scm for the rest
+sparrow_vm* sparrow_create(void);
+
+// evaluate every expression in 'filename', returns 0 on success and -1 if
+// the file can't be read or an error was raised
+int sparrow_load(sparrow_vm* vm, const char* filename);
+
+// evaluate every expression in 'source', returns the value of the last one,
+// or NULL if an error was raised
+struct object* sparrow_eval(sparrow_vm* vm, const char* source);
+
+// the error raised by the last sparrow_load or sparrow_eval, NULL if none;
+// the vm stays usable after an error
+struct object* sparrow_error(sparrow_vm* vm);
+
+// print a value to 'out' the way the repl does
+void sparrow_print(sparrow_vm* vm, struct object* o, FILE* out);
+
+// answer framed requests on the unix socket 'path' until SIGINT or SIGTERM,
+// from 'workers' forked processes (0: this one) that are replaced after
+// 'recycle' connections (0: never) or when they die. returns 0 on a clean
+// shutdown and -1 if the socket could not be set up
+int sparrow_serve(sparrow_vm* vm, const char* path, int workers, int recycle);
+
+// free the vm and every object it allocated
+void sparrow_destroy(sparrow_vm* vm);
+
+#endif